@@ -2,12 +2,17 @@
 #include <vector>
 #include <stdio.h>
 #include "avl.h"
+#include "ucblob.h"
 #include <stdlib.h>
 #include <set>
+#include <string>
+#include <algorithm>
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <limits.h>
 
 typedef std::map<int, int> casemap;
 typedef std::vector<int> charmap;
@@ -46,6 +51,126 @@ static bool
 
 static int span = 12, spanu8 = 0;
 
+/* -O: run optimization passes on intervals and pick the cheapest mapping class */
+static bool optimize;
+static int branch_cost = 64;
+
+struct cp_range {
+	int first, last;
+};
+
+/* Ranges from -p, their intervals are tested in this order before the tree */
+static std::vector<cp_range> prio;
+
+/* Named code point ranges for -r, scripts are listed with their case pairs only */
+static const struct {
+	const char	*name;
+	cp_range	r;
+} scripts[] = {
+	{"ascii",		{0x0000, 0x007F}},
+	{"latin",		{0x0000, 0x024F}},
+	{"latin",		{0x1E00, 0x1EFF}},
+	{"latin",		{0x2C60, 0x2C7F}},
+	{"latin",		{0xA720, 0xA7FF}},
+	{"latin",		{0xFF00, 0xFF5F}},
+	{"greek",		{0x0370, 0x03FF}},
+	{"greek",		{0x1F00, 0x1FFF}},
+	{"cyrillic",	{0x0400, 0x052F}},
+	{"cyrillic",	{0x1C80, 0x1C8F}},
+	{"cyrillic",	{0x2DE0, 0x2DFF}},
+	{"cyrillic",	{0xA640, 0xA69F}},
+	{"armenian",	{0x0530, 0x058F}},
+	{"georgian",	{0x10A0, 0x10FF}},
+	{"georgian",	{0x1C90, 0x1CBF}},
+	{"bmp",			{0x0000, 0xFFFF}},
+	{"astral",		{0x10000, 0x1FFFFF}},
+};
+
+/* Counter descriptions for -i, NULL when /tmp/x is not instrumented */
+static FILE *prof;
+static unsigned prof_slots;
+
+/* Describes next counter in -i header, returns its index or -1 */
+static int
+prof_slot(int first, int last, unsigned depth, const char *kind)
+{
+	if (!prof)
+		return -1;
+	fprintf(prof, "\t{0x%04X, 0x%04X, %u, UCASE_PROF_%s},\n", first, last, depth, kind);
+	return prof_slots++;
+}
+
+static void
+prof_hit(FILE *out, int n)
+{
+	if (n >= 0)
+		fprintf(out, "\tUCASE_HIT(%d);\n", n);
+}
+
+/* Index of priority range that contains c or -1 */
+static int
+prio_class(int c)
+{
+	for (unsigned i = 0; i < prio.size(); i++)
+		if (c >= prio[i].first && c <= prio[i].last)
+			return i;
+	return -1;
+}
+
+/* Expected access frequency rank of character for -a: priority ranges (-p) in
+ * their order, then main ranges of scripts, then their extensions, then the rest */
+static unsigned
+hotness(int c)
+{
+	const unsigned n = sizeof(scripts) / sizeof(*scripts);
+	int p = prio_class(c);
+	if (p >= 0)
+		return p;
+	for (unsigned ext = 0; ext < 2; ext++) {
+		for (unsigned i = 0; i < n; i++) {
+			bool main = !i || strcmp(scripts[i].name, scripts[i - 1].name);
+			if (main != !ext || !strcmp(scripts[i].name, "bmp") || !strcmp(scripts[i].name, "astral"))
+				continue;
+			if (c >= scripts[i].r.first && c <= scripts[i].r.last)
+				return prio.size() + ext * n + i;
+		}
+	}
+	return prio.size() + 2 * n;
+}
+
+/* When false translation tables are not emitted next to the code that uses them,
+ * caller is responsible to dump them at file scope with map_info::tables() */
+static bool local_tables = true;
+static const char *tbl_prefix = "ucase";
+/* -e: translation tables hold fold(c) - c instead of fold(c) */
+static bool delta_tables;
+/* -a: all translation tables are members of one cache line aligned structure
+ * PREFIX_tbl, placed in order of hotness() */
+static bool packed_tables;
+/* -M: exceptions of set/delta mappings as bitmask + popcount rank, see exclusion_mapping */
+static bool mask_ex;
+
+/* Tables already emitted at file scope. Table that is the same as (or a slice of)
+ * some of them reuses it instead of being emitted again. */
+struct shared_table {
+	int			first;
+	charmap		cm;
+	std::string	name;
+	bool		delta;	/* holds fold(c) - c, see -e */
+};
+static std::vector<shared_table> shared_tables;
+static unsigned shared_saved;
+
+/* Table as member of packed structure (-a) */
+struct table_data {
+	int			first;		/* characters it serves, for hotness() */
+	int			last;
+	std::string	type;
+	std::string	name;		/* member name */
+	std::string	values;		/* initializer */
+	unsigned	size;		/* number of entries */
+};
+
 struct cm_data {
 	int			first;
 	int			last;
@@ -76,6 +201,24 @@ public:
 	}
 
 	virtual void print_ret(FILE *out, const char *var, gen_res_cb res) const = 0;
+	/* Emit translation tables (if any) using "decl" as storage specifier */
+	virtual void print_data(FILE *out, const char *decl) const {}
+	/* Binary representation for "cf -b", translation values are appended to data */
+	virtual void blob(ucblob_node &n, std::vector<unsigned> &data) const = 0;
+	/* Adds branches and table bytes that print_ret() will produce, see -O */
+	virtual void cost(int &branches, int &data) const {}
+	/* Appends translation tables used by print_ret(), see -a */
+	virtual void collect(std::vector<table_data> &v) const {}
+
+	void blob_init(ucblob_node &n, unsigned kind, int arg) const {
+		n.first = first;
+		n.last = last;
+		n.kind = kind;
+		n.arg = arg;
+		n.tbl_first = 1;
+		n.tbl_last = 0;
+		n.tbl = 0;
+	}
 };
 
 class xlat_mapping : public case_mapping {
@@ -83,26 +226,119 @@ class xlat_mapping : public case_mapping {
 public:
 	xlat_mapping(int first, int last, const charmap &cm) : case_mapping(first, last), cm(cm) {}
 
-	void print_ret(FILE *out, const char *var, gen_res_cb res) const {
-		unsigned i;
-		bool is_short = true;
-		char c = '{';
-		for (i = 0; i < cm.size(); i++) {
-			if (cm[i] > 0xffff) {
-				is_short = false;
-				break;
+	bool is_short() const {
+		for (unsigned i = 0; i < cm.size(); i++)
+			if (cm[i] > 0xffff)
+				return false;
+		return true;
+	}
+
+	/* With -e table holds fold(c) - c as signed char when all of them fit */
+	bool is_delta() const {
+		if (!delta_tables)
+			return false;
+		for (unsigned i = 0; i < cm.size(); i++)
+			if (cm[i] - first - (int)i < -128 || cm[i] - first - (int)i > 127)
+				return false;
+		return true;
+	}
+
+	unsigned elt_size() const {
+		return is_delta() ? 1 : is_short() ? 2 : 4;
+	}
+
+	/* Table emitted at file scope that covers this one */
+	const shared_table *shared() const {
+		for (unsigned i = 0; i < shared_tables.size(); i++) {
+			const shared_table &t = shared_tables[i];
+			if (t.first <= first && t.first + (int)t.cm.size() > last &&
+					std::equal(cm.begin(), cm.end(), t.cm.begin() + (first - t.first)))
+				return &t;
+		}
+		return NULL;
+	}
+
+	void print_data(FILE *out, const char *decl) const {
+		char name[64];
+		if (!local_tables) {
+			shared_table t;
+			if (shared()) {
+				shared_saved += cm.size() * elt_size();
+				return;
 			}
+			t.first = first;
+			t.cm = cm;
+			t.delta = is_delta();
+			snprintf(name, sizeof(name), "%s_%04X_%04X", tbl_prefix, first, last);
+			t.name = name;
+			shared_tables.push_back(t);
 		}
-		fprintf(out, "\tstatic const unsigned%s ucase_%04X_%04X[] = ", is_short ? " short" : "", first, last);
-		for (i = 0; i < cm.size(); i++) {
-			fprintf(out, "%c0x%04X", c, cm[i]);
-			c = ',';
+		fprintf(out, "%s %s %s_%04X_%04X[] = %s;\n", decl, type(), tbl_prefix, first, last, values().c_str());
+	}
+
+	const char *type() const {
+		return is_delta() ? "signed char" : is_short() ? "unsigned short" : "unsigned";
+	}
+
+	std::string values() const {
+		std::string s;
+		char buf[16];
+		for (unsigned i = 0; i < cm.size(); i++) {
+			if (is_delta())
+				snprintf(buf, sizeof(buf), "%c%d", i ? ',' : '{', cm[i] - first - (int)i);
+			else
+				snprintf(buf, sizeof(buf), "%c0x%04X", i ? ',' : '{', cm[i]);
+			s += buf;
 		}
-		fprintf(out, "};\n");
-		res(out, "ucase_%04X_%04X[%s - 0x%04X]", first, last, var, first);
-		data_size = cm.size() * (is_short ? 2 : 4);
+		return s + "}";
+	}
+
+	void collect(std::vector<table_data> &v) const {
+		table_data t;
+		char name[32];
+		snprintf(name, sizeof(name), "t%04X_%04X", first, last);
+		t.first = first;
+		t.last = last;
+		t.type = type();
+		t.name = name;
+		t.values = values();
+		t.size = cm.size();
+		v.push_back(t);
+	}
+
+	void print_ret(FILE *out, const char *var, gen_res_cb res) const {
+		const shared_table *t = local_tables || packed_tables ? NULL : shared();
+		bool delta = t ? t->delta : is_delta();
+		const char *base = delta ? var : "", *add = delta ? " + " : "";
+		if (packed_tables) {
+			res(out, "%s%s%s_tbl.t%04X_%04X[%s - 0x%04X]", base, add, tbl_prefix, first, last, var, first);
+		} else if (t) {
+			res(out, "%s%s%s[%s - 0x%04X]", base, add, t->name.c_str(), var, t->first);
+		} else {
+			if (local_tables)
+				print_data(out, "\tstatic const");
+			res(out, "%s%s%s_%04X_%04X[%s - 0x%04X]", base, add, tbl_prefix, first, last, var, first);
+		}
+		data_size = cm.size() * elt_size();
 		branch_count = 0;
 	}
+
+	void cost(int &branches, int &data) const {
+		data += cm.size() * elt_size();
+	}
+
+	/* Attach this table to (possibly other) node */
+	void blob_table(ucblob_node &n, std::vector<unsigned> &data) const {
+		n.tbl_first = first;
+		n.tbl_last = last;
+		n.tbl = data.size();
+		data.insert(data.end(), cm.begin(), cm.end());
+	}
+
+	void blob(ucblob_node &n, std::vector<unsigned> &data) const {
+		blob_init(n, UCBLOB_XLAT, 0);
+		blob_table(n, data);
+	}
 };
 
 class delta_mapping : public case_mapping {
@@ -116,25 +352,183 @@ public:
 		else
 			res(out, "%s - %d", var, -delta);
 	}
+
+	void blob(ucblob_node &n, std::vector<unsigned> &data) const {
+		blob_init(n, UCBLOB_DELTA, delta);
+	}
 };
 
 class exclusion_mapping : public case_mapping {
 	casemap ex;
 protected:
 	virtual const char *expr(const char *var) const = 0;
+	virtual int apply(int c) const = 0;
+	virtual void blob_expr(ucblob_node &n) const = 0;
 public:
 	exclusion_mapping(int first, int last, const casemap &e) : case_mapping(first, last), ex(e) {}
+
+	/* Translation table for exceptions, only used when there are more than one.
+	 * Characters between exceptions are filled with results of expression. */
+	xlat_mapping ex_table() const {
+		charmap c;
+		for (int ch = ex.begin()->first; ch <= ex.rbegin()->first; ch++) {
+			casemap::const_iterator i = ex.find(ch);
+			c.push_back(i == ex.end() ? apply(ch) : i->second);
+		}
+		return xlat_mapping(ex.begin()->first, ex.rbegin()->first, c);
+	}
+
+	/* -M: presence bitmask over the interval, cumulative popcount of preceding
+	 * words (if more than one) and dense array of exceptions that really differ
+	 * from expression, whichever of this and ex_table() is cheaper counting
+	 * branch_cost for every branch (mask takes one, table one per side where
+	 * the interval goes beyond it) */
+	bool use_mask() const {
+		int branches, data = 0;
+		if (!mask_ex || ex.size() < 2)
+			return false;
+		branches = (ex.begin()->first > first) + (ex.rbegin()->first < last);
+		ex_table().cost(branches, data);
+		return branch_cost + mask_size() <= branches * branch_cost + data;
+	}
+
+	casemap real_ex() const {
+		casemap r;
+		for (casemap::const_iterator i = ex.begin(); i != ex.end(); ++i)
+			if (i->second != apply(i->first))
+				r.insert(*i);
+		return r;
+	}
+
+	unsigned mask_words() const {
+		return (last - first) / 64 + 1;
+	}
+
+	int mask_size() const {
+		casemap r = real_ex();
+		bool wide = false;
+		for (casemap::const_iterator i = r.begin(); i != r.end(); ++i)
+			wide = wide || i->second > 0xffff;
+		return mask_words() * (mask_words() > 1 ? 10 : 8) + r.size() * (wide ? 4 : 2);
+	}
+
+	/* Tables of -M encoding: mask, exceptions and ranks (when there are several words) */
+	void mask_tables(std::vector<table_data> &v) const {
+		casemap r = real_ex();
+		std::vector<unsigned long long> mask(mask_words(), 0);
+		std::string s;
+		char buf[32];
+		table_data t;
+		bool wide = false;
+		t.first = first;
+		t.last = last;
+		for (casemap::const_iterator i = r.begin(); i != r.end(); ++i) {
+			mask[(i->first - first) >> 6] |= 1ULL << ((i->first - first) & 63);
+			snprintf(buf, sizeof(buf), "%c0x%04X", s.empty() ? '{' : ',', i->second);
+			s += buf;
+			wide = wide || i->second > 0xffff;
+		}
+		snprintf(buf, sizeof(buf), "m%04X_%04X", first, last);
+		t.name = buf;
+		t.type = "unsigned long long";
+		t.size = mask.size();
+		t.values.clear();
+		for (unsigned i = 0; i < mask.size(); i++) {
+			snprintf(buf, sizeof(buf), "%c0x%016llXULL", i ? ',' : '{', mask[i]);
+			t.values += buf;
+		}
+		t.values += "}";
+		v.push_back(t);
+		snprintf(buf, sizeof(buf), "x%04X_%04X", first, last);
+		t.name = buf;
+		t.type = wide ? "unsigned" : "unsigned short";
+		t.size = r.size();
+		t.values = s + "}";
+		v.push_back(t);
+		if (mask.size() > 1) {
+			unsigned rank = 0;
+			snprintf(buf, sizeof(buf), "r%04X_%04X", first, last);
+			t.name = buf;
+			t.type = "unsigned short";
+			t.size = mask.size();
+			t.values.clear();
+			for (unsigned i = 0; i < mask.size(); i++) {
+				snprintf(buf, sizeof(buf), "%c%u", i ? ',' : '{', rank);
+				t.values += buf;
+				rank += __builtin_popcountll(mask[i]);
+			}
+			t.values += "}";
+			v.push_back(t);
+		}
+	}
+
+	void print_data(FILE *out, const char *decl) const {
+		if (use_mask()) {
+			std::vector<table_data> v;
+			mask_tables(v);
+			for (unsigned i = 0; i < v.size(); i++)
+				fprintf(out, "%s %s %s_%s[] = %s;\n", decl, v[i].type.c_str(), tbl_prefix,
+						v[i].name.c_str(), v[i].values.c_str());
+		} else if (ex.size() > 1) {
+			ex_table().print_data(out, decl);
+		}
+	}
+
+	void collect(std::vector<table_data> &v) const {
+		if (use_mask())
+			mask_tables(v);
+		else if (ex.size() > 1)
+			ex_table().collect(v);
+	}
+
+	void blob(ucblob_node &n, std::vector<unsigned> &data) const {
+		blob_expr(n);
+		ex_table().blob_table(n, data);
+	}
+
+	void cost(int &branches, int &data) const {
+		if (ex.size() == 1) {
+			branches++;
+		} else if (use_mask()) {
+			branches++;
+			data += mask_size();
+		} else {
+			branches += (ex.begin()->first > first) + (ex.rbegin()->first < last);
+			ex_table().cost(branches, data);
+		}
+	}
+
+	void print_mask(FILE *out, const char *var, gen_res_cb res) const {
+		char m[64], x[64], r[64], rank[160];
+		const char *sep = packed_tables ? "_tbl." : "_";
+		snprintf(m, sizeof(m), "%s%sm%04X_%04X", tbl_prefix, sep, first, last);
+		snprintf(x, sizeof(x), "%s%sx%04X_%04X", tbl_prefix, sep, first, last);
+		snprintf(r, sizeof(r), "%s%sr%04X_%04X", tbl_prefix, sep, first, last);
+		if (local_tables && !packed_tables)
+			print_data(out, "\tstatic const");
+		fprintf(out, "\tif (!(%s[(%s - 0x%04X) >> 6] >> ((%s - 0x%04X) & 63) & 1))\n\t",
+				m, var, first, var, first);
+		res(out, "%s", expr(var));
+		if (mask_words() > 1)
+			snprintf(rank, sizeof(rank), "%s[(%s - 0x%04X) >> 6] + ", r, var, first);
+		else
+			rank[0] = 0;
+		res(out, "%s[%s__builtin_popcountll(%s[(%s - 0x%04X) >> 6] & ((1ULL << ((%s - 0x%04X) & 63)) - 1))]",
+				x, rank, m, var, first, var, first);
+		branch_count = 1;
+		data_size = mask_size();
+	}
+
 	void print_ret(FILE *out, const char *var, gen_res_cb res) const {
 		if (ex.size() == 1) {
 			res(out, "%s != 0x%04X ? %s : 0x%04X",
 					var, ex.begin()->first, expr(var), ex.begin()->second);
 			branch_count = 1;
+		} else if (use_mask()) {
+			print_mask(out, var, res);
 		} else {
-			charmap c;
+			xlat_mapping x = ex_table();
 			branch_count = 0;
-			for (casemap::const_iterator i = ex.begin(); i != ex.end(); ++i)
-				c.push_back(i->second);
-			xlat_mapping x(ex.begin()->first, ex.rbegin()->first, c);
 			if (ex.begin()->first > first) {
 				fprintf(out, "\tif (%s < 0x%04X)\n\t",
 						var, ex.begin()->first);
@@ -163,6 +557,12 @@ protected:
 		snprintf(buf, sizeof(buf), "%s %c %d", var, delta < 0 ? '-' : '+', delta < 0 ? -delta : delta);
 		return buf;
 	}
+	int apply(int c) const {
+		return c + delta;
+	}
+	void blob_expr(ucblob_node &n) const {
+		blob_init(n, UCBLOB_DELTA, delta);
+	}
 public:
 	delta_ex_mapping(int first, int last, const casemap &e, int delta) : exclusion_mapping(first, last, e), delta(delta) {}
 };
@@ -173,6 +573,10 @@ public:
 	void print_ret(FILE *out, const char *var, gen_res_cb res) const {
 		res(out, "%s | 1", var);
 	}
+
+	void blob(ucblob_node &n, std::vector<unsigned> &data) const {
+		blob_init(n, UCBLOB_SET, 0);
+	}
 };
 
 class set_ex_mapping : public exclusion_mapping {
@@ -182,6 +586,12 @@ protected:
 		snprintf(buf, sizeof(buf), "%s | 1", var);
 		return buf;
 	}
+	int apply(int c) const {
+		return c | 1;
+	}
+	void blob_expr(ucblob_node &n) const {
+		blob_init(n, UCBLOB_SET, 0);
+	}
 public:
 	set_ex_mapping(int first, int last, const casemap &e) : exclusion_mapping(first, last, e) {}
 };
@@ -190,7 +600,11 @@ class reset_mapping : public case_mapping {
 public:
 	reset_mapping(int first, int last) : case_mapping(first, last) {}
 	void print_ret(FILE *out, const char *var, gen_res_cb res) const {
-		res(out, "%s !!! 1", var);
+		res(out, "%s & ~1", var);
+	}
+
+	void blob(ucblob_node &n, std::vector<unsigned> &data) const {
+		blob_init(n, UCBLOB_RESET, 0);
 	}
 };
 
@@ -201,6 +615,10 @@ public:
 	void print_ret(FILE *out, const char *var, gen_res_cb res) const {
 		res(out, "0x%04X", result);
 	}
+
+	void blob(ucblob_node &n, std::vector<unsigned> &data) const {
+		blob_init(n, UCBLOB_SINGLE, result);
+	}
 };
 
 static bool
@@ -234,6 +652,17 @@ make_sequental(casemap &m, int (*cm)(int c, int arg), int arg)
 	return true;
 }
 
+/* Exceptions to expression over n characters are acceptable for -M when they
+ * are a minority, a bitmask of mostly set bits is a translation table with
+ * extra branch. Otherwise gaps between them must be closed by make_sequental. */
+static bool
+fits_ex(casemap &ex, int n, int (*cm)(int c, int arg), int arg)
+{
+	if (mask_ex && (int)ex.size() * 2 < n)
+		return true;
+	return make_sequental(ex, cm, arg);
+}
+
 static int map_set(int c, int dummy)
 {
 	return c | 1;
@@ -244,7 +673,56 @@ static int map_delta(int c, int delta)
 	return c + delta;
 }
 
-case_mapping *get_mapping(int first, int last, const charmap &m)
+/* Cost of interval as tree node in bytes, every branch is worth branch_cost bytes of tables */
+static int
+mapping_cost(const case_mapping *p)
+{
+	int branches = 1, data = 0;
+	p->cost(branches, data);
+	return branches * branch_cost + data;
+}
+
+/* Classification for -O: every class that fits is tried (delta with any number of
+ * exceptions as well) and the cheapest one wins, ties go to the simpler class */
+static case_mapping *
+cheapest_mapping(int first, int last, const charmap &m, int delta, int dell, const casemap &delta_ex,
+		int setl, int resl, const casemap &set_ex)
+{
+	std::vector<case_mapping*> c;
+	case_mapping *best = NULL;
+	int best_cost = 0;
+	if (allow_delta && delta_ex.empty())
+		c.push_back(new delta_mapping(first, last, delta));
+	if (allow_delta_ex && !delta_ex.empty() && dell) {
+		casemap ex(delta_ex);
+		if (fits_ex(ex, m.size(), map_delta, delta))
+			c.push_back(new delta_ex_mapping(first, last, ex, delta));
+	}
+	if (allow_set && setl == (int)m.size())
+		c.push_back(new set_mapping(first, last));
+	if (allow_res && !resl)
+		c.push_back(new reset_mapping(first, last));
+	if (allow_set_ex && setl && !set_ex.empty()) {
+		casemap ex(set_ex);
+		if (fits_ex(ex, m.size(), map_set, 0))
+			c.push_back(new set_ex_mapping(first, last, ex));
+	}
+	c.push_back(new xlat_mapping(first, last, m));
+	for (unsigned i = 0; i < c.size(); i++) {
+		int cost = mapping_cost(c[i]);
+		if (!best || cost < best_cost) {
+			delete best;
+			best = c[i];
+			best_cost = cost;
+		} else {
+			delete c[i];
+		}
+	}
+	return best;
+}
+
+/* cheapest picks the class by cost (-O), otherwise the first class that fits wins */
+case_mapping *get_mapping(int first, int last, const charmap &m, bool cheapest = optimize)
 {
 	int delta;
 	int i;
@@ -270,12 +748,14 @@ case_mapping *get_mapping(int first, int last, const charmap &m)
 		} else {
 			set_ex[first + i] = m[i];
 		}
-		if ((m[i] & ~1) != first + i) {
+		if (m[i] != ((first + i) & ~1)) {
 			resl++;
 		} else {
 			resc.insert(first + i);
 		}
 	}
+	if (cheapest)
+		return cheapest_mapping(first, last, m, delta, dell, delta_ex, setl, resl, set_ex);
 	if (setl && setl != (int)m.size())
 		fprintf(stderr, "set: %04X: %d of %d\n", first, setl, (int)m.size());
 	if (resl && resl != (int)m.size())
@@ -291,15 +771,18 @@ case_mapping *get_mapping(int first, int last, const charmap &m)
 		return new set_mapping(first, last);
 	else if (allow_res && !resl)
 		return new reset_mapping(first, last);
-	else if (allow_set_ex && (setl + set_ex.size() == m.size() && make_sequental(set_ex, map_set, 0)))
+	else if (allow_set_ex && (setl + set_ex.size() == m.size() && fits_ex(set_ex, m.size(), map_set, 0)))
 		return new set_ex_mapping(first, last, set_ex);
 	else
 		return new xlat_mapping(first, last, m);
 }
 
 class map_info {
+public:
+	std::string				passes;	/* summary of -O passes */
+private:
 	avl_tree				*m_tree;
-	std::vector<cm_data*>	m_prio;
+	std::vector<case_mapping*>	m_prio;
 	static int avl_cmp(void *arg, void *k1, void *k2) {
 		case_mapping *l = (case_mapping*)k1, *r = (case_mapping*)k2;
 		return l->first < r->first ? -1 : l->first > r->first ? 1 : 0;
@@ -312,6 +795,68 @@ class map_info {
 			dump_helper(a, 2 * i + 2, cur->right);
 		}
 	}
+	static void dump_node(FILE *out, const std::vector<case_mapping*> &m, unsigned i,
+			const char *var, gen_res_cb res, int &branches, int &data) {
+		unsigned j;
+		fprintf(out, "\tif (%s < 0x%04X)", var, m[i]->first);
+		j = 2 * i + 1;
+		if (j < m.size() && m[j]) {
+			fprintf(out, " { /* %s */\n", m[j]->label());
+			dump_node(out, m, j, var, res, branches, data);
+			fprintf(out, "\t}\n");
+		} else {
+			fprintf(out, "\n\t");
+			res(out, "%s", var);
+		}
+		fprintf(out, "\tif (%s > 0x%04X)", var, m[i]->last);
+		j = 2 * i + 2;
+		if (j < m.size() && m[j]) {
+			fprintf(out, " { /* %s */\n", m[j]->label());
+			dump_node(out, m, j, var, res, branches, data);
+			fprintf(out, "\t}\n");
+		} else {
+			fprintf(out, "\n\t");
+			res(out, "%s", var);
+		}
+		m[i]->print_ret(out, var, res);
+		branches += m[i]->branch_count + 1;
+		data += m[i]->data_size;
+	}
+	/* Leaf that returns unchanged character, counted in slot n (if any) */
+	static void dump_miss(FILE *out, const char *var, gen_res_cb res, int n) {
+		if (n < 0) {
+			fprintf(out, "\n\t");
+			res(out, "%s", var);
+		} else {
+			fprintf(out, " {\n\t\tUCASE_HIT(%d);\n\t", n);
+			res(out, "%s", var);
+			fprintf(out, "\t}\n");
+		}
+	}
+	static bool less_first(const case_mapping *l, const case_mapping *r) {
+		return l->first < r->first;
+	}
+	static bool less_prio(const case_mapping *l, const case_mapping *r) {
+		int pl = prio_class(l->first), pr = prio_class(r->first);
+		return pl < pr || (pl == pr && l->first < r->first);
+	}
+	/* Priority intervals as plain range checks, tree is not entered for them */
+	void dump_prio(FILE *out, const char *var, gen_res_cb res, int &branches, int &data) {
+		if (m_prio.empty())
+			return;
+		std::sort(m_prio.begin(), m_prio.end(), less_prio);
+		fprintf(out, "/* %u priority intervals */\n", (unsigned)m_prio.size());
+		for (unsigned i = 0; i < m_prio.size(); i++) {
+			fprintf(out, "\tif (%s >= 0x%04X && %s <= 0x%04X) {\n", var, m_prio[i]->first, var, m_prio[i]->last);
+			prof_hit(out, prof_slot(m_prio[i]->first, m_prio[i]->last, 0, "PRIO"));
+			m_prio[i]->print_ret(out, var, res);
+			fprintf(out, "\t}\n");
+			branches += m_prio[i]->branch_count + 2;
+			data += m_prio[i]->data_size;
+		}
+		if (!m_tree->root->right)
+			res(out, "%s", var);
+	}
 	static int free_node(void *n) {
 		delete (case_mapping*)n;
 		return 1;
@@ -322,52 +867,147 @@ public:
 	}
 	~map_info() {
 		avl_tree_free(m_tree, free_node);
+		for (unsigned i = 0; i < m_prio.size(); i++)
+			delete m_prio[i];
 	}
 
 	void insert(const cm_data &d) {
 		case_mapping *p;
-#if 0
-		/* Check for priority intervals */
-		if ((d.first <= 'T' && d.last >= 'T') ||
-				(d.first <= 0x0410 && d.last >= 0x0410))
-		{
-			/* Interval contains ASCII or Cyrillic letters */
-			m_prio.push_back(new cm_data(d));
+		/* codegen_map() does not let intervals cross borders of priority ranges */
+		if (prio_class(d.first) >= 0) {
+			m_prio.push_back(get_mapping(d.first, d.last, d.cm));
+			return;
 		}
-#endif
 		if (avl_get_by_key(m_tree, (void*)&d, (void**)&p) != 0) {
 			p = get_mapping(d.first, d.last, d.cm);
 			avl_insert(m_tree, p);
 		}
 	}
 
+	/* Lays out the tree as implicit binary heap: children of m[i] are m[2i+1] and m[2i+2] */
+	void layout(std::vector<case_mapping*> &m) const {
+		m.assign(1 << (m_tree->height + 1), NULL);
+		dump_helper(&m[0], 0, m_tree->root->right);
+	}
+
+	/* All intervals sorted by first character */
+	void mappings(std::vector<case_mapping*> &v) const {
+		std::vector<case_mapping*> m;
+		layout(m);
+		v.clear();
+		for (unsigned i = 0; i < m.size(); i++)
+			if (m[i])
+				v.push_back(m[i]);
+		v.insert(v.end(), m_prio.begin(), m_prio.end());
+		std::sort(v.begin(), v.end(), less_first);
+	}
+
+	/* Tree height, branches and table bytes of dump() */
+	void cost(int &height, int &branches, int &data) const {
+		std::vector<case_mapping*> v;
+		mappings(v);
+		height = m_tree->height + 1;
+		for (unsigned i = 0; i < v.size(); i++) {
+			branches += v[i]->branch_count + 1;
+			data += v[i]->data_size;
+		}
+		branches += m_prio.size();
+	}
+
+	/* All translation tables as members of PREFIX_tbl, hot ones first */
+	void packed(FILE *out, const char *decl) const {
+		std::vector<case_mapping*> v;
+		std::vector<table_data> t;
+		std::vector<std::pair<std::pair<unsigned, int>, unsigned> > order;
+		mappings(v);
+		for (unsigned i = 0; i < v.size(); i++)
+			v[i]->collect(t);
+		if (t.empty())
+			return;
+		for (unsigned i = 0; i < t.size(); i++) {
+			unsigned h = hotness(t[i].first);
+			for (int c = t[i].first + 1; c <= t[i].last; c++)
+				h = std::min(h, hotness(c));
+			order.push_back(std::make_pair(std::make_pair(h, t[i].first), i));
+		}
+		/* Tables of one mapping have the same rank and first, so they stay together */
+		std::sort(order.begin(), order.end());
+		fprintf(out, "%s struct {\n", decl);
+		for (unsigned i = 0; i < order.size(); i++) {
+			const table_data &x = t[order[i].second];
+			fprintf(out, "\t%s %s[%u];\n", x.type.c_str(), x.name.c_str(), x.size);
+		}
+		fprintf(out, "} __attribute__((aligned(64))) %s_tbl = {\n", tbl_prefix);
+		for (unsigned i = 0; i < order.size(); i++)
+			fprintf(out, "\t%s,\n", t[order[i].second].values.c_str());
+		fprintf(out, "};\n");
+	}
+
+	/* Emit translation tables of all intervals at file scope */
+	void tables(FILE *out, const char *decl) const {
+		std::vector<case_mapping*> m;
+		if (packed_tables) {
+			packed(out, decl);
+			return;
+		}
+		layout(m);
+		for (unsigned i = 0; i < m_prio.size(); i++)
+			m_prio[i]->print_data(out, decl);
+		for (unsigned i = 0; i < m.size(); i++)
+			if (m[i])
+				m[i]->print_data(out, decl);
+	}
+
+	/* Same tree as dump() but built of nested blocks instead of goto, so that
+	 * it may be used where goto is not welcome (i.e. C++ constexpr functions) */
+	void dump_nested(FILE *out, const char *var, gen_res_cb res) {
+		std::vector<case_mapping*> m;
+		int branches = 0, data = 0;
+		layout(m);
+		fputs(passes.c_str(), out);
+		if (packed_tables && local_tables)
+			packed(out, "\tstatic const");
+		dump_prio(out, var, res, branches, data);
+		fprintf(out, "/* tree height is %d */\n", m_tree->height + 1);
+		if (m[0])
+			dump_node(out, m, 0, var, res, branches, data);
+		fprintf(out, "/* %d branches, %d cdata bytes */\n", branches, data);
+	}
+
 	void dump(FILE *out, const char *var, gen_res_cb res) {
 		int branches = 0;
 		int data = 0;
 		std::vector<case_mapping*> m;
-		m.resize(1 << (m_tree->height + 1));
+		layout(m);
+		fputs(passes.c_str(), out);
+		if (packed_tables && local_tables)
+			packed(out, "\tstatic const");
+		dump_prio(out, var, res, branches, data);
 		fprintf(out, "/* tree height is %d */\n", m_tree->height + 1);
-		dump_helper(&m[0], 0, m_tree->root->right);
 		for (unsigned i = 0; i < m.size(); i++) {
 			if (m[i]) {
-				unsigned j;
+				unsigned j, depth = 1;
+				for (j = i; j; j = (j - 1) / 2)
+					depth++;
 #if 1
 				if (i)
 					fprintf(out, "%s:\n", m[i]->label());
-				fprintf(out, "\tif (%s < 0x%04X)\n\t", var, m[i]->first);
+				prof_hit(out, prof_slot(m[i]->first, m[i]->last, depth, "NODE"));
+				fprintf(out, "\tif (%s < 0x%04X)", var, m[i]->first);
 //				fprintf(out, "\tif (%s > 0x%04X)\n", var, m[i]->last);
 				j = 2 * i + 1;
 				if (j < m.size() && m[j])
-					fprintf(out, "\tgoto %s;\n", m[j]->label());
+					fprintf(out, "\n\t\tgoto %s;\n", m[j]->label());
 				else
-					res(out, "%s", var);
-				fprintf(out, "\tif (%s > 0x%04X)\n\t", var, m[i]->last);
+					dump_miss(out, var, res, prof_slot(m[i]->first, m[i]->last, depth, "BELOW"));
+				fprintf(out, "\tif (%s > 0x%04X)", var, m[i]->last);
 //				fprintf(out, "\tif (%s < 0x%04X)\n", var, m[i]->first);
 				j = 2 * i + 2;
 				if (j < m.size() && m[j])
-					fprintf(out, "\tgoto %s;\n", m[j]->label());
+					fprintf(out, "\n\t\tgoto %s;\n", m[j]->label());
 				else
-					res(out, "%s", var);
+					dump_miss(out, var, res, prof_slot(m[i]->first, m[i]->last, depth, "ABOVE"));
+				prof_hit(out, prof_slot(m[i]->first, m[i]->last, depth, "HIT"));
 				m[i]->print_ret(out, var, res);
 #else
 				/* This is "test" generator that makes sequences of "char in [first, last]" statements */
@@ -385,26 +1025,167 @@ public:
 	}
 };
 
+/* Optimization passes of -O. Intervals are kept as cm_data (gaps inside are
+ * filled with identity), every pass changes them only if cost goes down. */
+
+static int
+ir_cost(const cm_data &d)
+{
+	case_mapping *p = get_mapping(d.first, d.last, d.cm, true);
+	int cost = mapping_cost(p);
+	delete p;
+	return cost;
+}
+
+/* Appends summary line of intervals after pass "name" to log, cheapest is
+ * passed to get_mapping() */
 static void
-codegen(casemap::const_iterator begin, casemap::const_iterator end, FILE *out, const char *var, gen_res_cb res, unsigned sp)
+ir_report(const std::vector<cm_data> &v, const char *name, std::string &log, bool cheapest = true)
+{
+	int branches = 0, data = 0;
+	char buf[128];
+	for (unsigned i = 0; i < v.size(); i++) {
+		case_mapping *p = get_mapping(v[i].first, v[i].last, v[i].cm, cheapest);
+		branches++;
+		p->cost(branches, data);
+		delete p;
+	}
+	snprintf(buf, sizeof(buf), "/* %-10s %3u intervals, %3d branches, %5d cdata bytes, cost %d */\n",
+			name, (unsigned)v.size(), branches, data, branches * branch_cost + data);
+	log += buf;
+}
+
+/* Joins neighbours (with identity gap between them) when one node is cheaper than two */
+static bool
+pass_merge(std::vector<cm_data> &v)
+{
+	bool changed = false;
+	for (unsigned i = 0; i + 1 < v.size(); ) {
+		cm_data &l = v[i], &r = v[i + 1];
+		if (r.first - l.last <= 256 && prio_class(l.first) == prio_class(r.first)) {
+			cm_data d(l.first, r.last, l.cm);
+			for (int c = l.last + 1; c < r.first; c++)
+				d.cm.push_back(c);
+			d.cm.insert(d.cm.end(), r.cm.begin(), r.cm.end());
+			if (ir_cost(d) < ir_cost(l) + ir_cost(r)) {
+				l = d;
+				v.erase(v.begin() + i + 1);
+				changed = true;
+				continue;
+			}
+		}
+		i++;
+	}
+	return changed;
+}
+
+/* Part [from, to] of interval without identity characters at both ends, false if nothing is left */
+static bool
+ir_slice(const cm_data &d, int from, int to, cm_data &part)
+{
+	while (from <= to && d.cm[from - d.first] == from)
+		from++;
+	while (to >= from && d.cm[to - d.first] == to)
+		to--;
+	if (from > to)
+		return false;
+	part.first = from;
+	part.last = to;
+	part.cm.assign(d.cm.begin() + (from - d.first), d.cm.begin() + (to - d.first + 1));
+	return true;
+}
+
+/* Kind of character for split points: fits "c | 1", fits "c & ~1" or delta */
+static int
+ir_kind(const cm_data &d, int c)
+{
+	int m = d.cm[c - d.first];
+	if (m == (c | 1))
+		return INT_MIN;
+	if (m == (c & ~1))
+		return INT_MIN + 1;
+	return m - c;
+}
+
+/* Cuts interval in two at the point that lowers cost most, i.e. to move run
+ * of "c | 1" characters out of translation table. Only boundaries between
+ * runs of characters of the same kind are tried, cutting inside a run never
+ * separates different classes. */
+static bool
+pass_split(std::vector<cm_data> &v)
+{
+	bool changed = false;
+	for (unsigned i = 0; i < v.size(); i++) {
+		cm_data best[2];
+		int nbest = 0, best_cost = ir_cost(v[i]);
+		for (int k = v[i].first + 1; k <= v[i].last; k++) {
+			cm_data p[2];
+			int n = 0, cost = 0;
+			if (ir_kind(v[i], k) == ir_kind(v[i], k - 1))
+				continue;
+			if (ir_slice(v[i], v[i].first, k - 1, p[n]))
+				cost += ir_cost(p[n++]);
+			if (ir_slice(v[i], k, v[i].last, p[n]))
+				cost += ir_cost(p[n++]);
+			if (cost < best_cost) {
+				best_cost = cost;
+				nbest = n;
+				for (int j = 0; j < n; j++)
+					best[j] = p[j];
+			}
+		}
+		if (nbest) {
+			v[i] = best[0];
+			if (nbest > 1)
+				v.insert(v.begin() + i + 1, best[1]);
+			i--;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+static void
+optimize_ir(std::vector<cm_data> &v, std::string &log)
+{
+	static const struct {
+		const char	*name;
+		bool		(*run)(std::vector<cm_data> &v);
+	} pipeline[] = {
+		{"merge", pass_merge},
+		{"split", pass_split},
+		{"merge", pass_merge},
+	};
+	ir_report(v, "collect", log, false);
+	ir_report(v, "reclassify", log);
+	for (unsigned i = 0; i < sizeof(pipeline) / sizeof(*pipeline); i++) {
+		while (pipeline[i].run(v))
+			;
+		ir_report(v, pipeline[i].name, log);
+	}
+}
+
+/* Splits [begin, end) into intervals no more than "sp" characters apart and
+ * fills map_info with them. Returns number of case conversions. */
+static unsigned
+codegen_map(casemap::const_iterator begin, casemap::const_iterator end, map_info &mi, unsigned sp)
 {
 	charmap m;
+	std::vector<cm_data> ir;
 	unsigned cvt = 0;
 	int last = 0, cnt = 0, first = 0;
-	map_info mi;
 	while (begin != end && begin->first == begin->second)
 		++begin;
 	while (end != begin && end->first == end->second)
 		--end;
 	if (begin == end)
-		return;
+		return 0;
 	first = begin->first;
 	for (casemap::const_iterator i = begin; i != end; ++i) {
 		cvt++;
-		if (i->first - last > sp) {
+		if (i->first - last > sp || prio_class(i->first) != prio_class(first)) {
 			if (!m.empty()) {
-				cm_data d(first, last, m);
-				mi.insert(d);
+				ir.push_back(cm_data(first, last, m));
 				m.clear();
 			}
 			first = i->first;
@@ -416,39 +1197,239 @@ codegen(casemap::const_iterator begin, casemap::const_iterator end, FILE *out, c
 		m.push_back(i->second);
 		last = i->first;
 	}
-	if (!m.empty()) {
-		cm_data d(first, last, m);
-		mi.insert(d);
-	}
+	if (!m.empty())
+		ir.push_back(cm_data(first, last, m));
+	if (optimize)
+		optimize_ir(ir, mi.passes);
+	for (unsigned i = 0; i < ir.size(); i++)
+		mi.insert(ir[i]);
+	return cvt;
+}
+
+static void
+codegen(casemap::const_iterator begin, casemap::const_iterator end, FILE *out, const char *var, gen_res_cb res, unsigned sp)
+{
+	map_info mi;
+	unsigned cvt = codegen_map(begin, end, mi, sp);
+	if (!cvt)
+		return;
 	mi.dump(out, var, res);
 	fprintf(out, "//%d case conversions\n", cvt);
 }
 
 static void
-gen_u_cvt(const casemap &cm, const char *fname)
+gen_u_cvt(const casemap &cm, const char *fname, const char *prof_hdr)
 {
 	FILE *out = fopen(fname, "w");
 	if (!out) {
 		perror("fopen");
 		exit(EXIT_FAILURE);
 	}
+	if (prof_hdr) {
+		prof = fopen(prof_hdr, "w");
+		if (!prof) {
+			perror("fopen");
+			exit(EXIT_FAILURE);
+		}
+		fprintf(prof, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+				"/* Counters of %s, see ucprof.c */\n"
+				"static const struct ucase_prof_slot ucase_prof_slots[] = {\n", fname);
+		/* Counting is off unless caller includes ucprof.h */
+		fprintf(out, "#ifndef UCASE_HIT\n#define UCASE_HIT(n)\n#endif\n");
+	}
 	codegen(cm.begin(), cm.end(), out, "c", gen_ret_cb, span);
 	fclose(out);
+	if (prof) {
+		fprintf(prof, "};\n");
+		fclose(prof);
+		prof = NULL;
+	}
+}
+
+/* Parses comma separated list of script names, "HEX-HEX" ranges and single "HEX"
+ * code points. Returns false on unknown item. */
+static bool
+parse_ranges(const char *spec, std::vector<cp_range> &r)
+{
+	std::string s(spec);
+	size_t pos = 0;
+	while (pos <= s.size()) {
+		size_t e = s.find(',', pos);
+		std::string item = s.substr(pos, e == std::string::npos ? std::string::npos : e - pos);
+		bool found = false;
+		unsigned a, b;
+		char tail;
+		for (unsigned i = 0; i < sizeof(scripts) / sizeof(*scripts); i++) {
+			if (item == scripts[i].name) {
+				r.push_back(scripts[i].r);
+				found = true;
+			}
+		}
+		if (!found) {
+			cp_range cr;
+			if (sscanf(item.c_str(), "%x-%x%c", &a, &b, &tail) == 2 && a <= b) {
+				cr.first = a;
+				cr.last = b;
+			} else if (sscanf(item.c_str(), "%x%c", &a, &tail) == 1) {
+				cr.first = cr.last = a;
+			} else {
+				return false;
+			}
+			r.push_back(cr);
+		}
+		if (e == std::string::npos)
+			break;
+		pos = e + 1;
+	}
+	return true;
+}
+
+/* Subset of casemap restricted to given ranges */
+static casemap
+sub_map(const casemap &cm, const cp_range *r, unsigned n)
+{
+	casemap sub;
+	for (unsigned i = 0; i < n; i++)
+		sub.insert(cm.lower_bound(r[i].first), cm.upper_bound(r[i].last));
+	return sub;
+}
+
+/* Backends for UTF-8 length classes of gen_u8_cvt(), see -U */
+enum u8_backend {
+	U8_TREE,	/* binary tree from codegen() */
+	U8_TABLE,	/* direct table of deltas over all changed characters, no tree */
+	U8_BITMAP	/* bitmap of 64 character blocks rejects unchanged ones before tree */
+};
+static const char *u8_backend_names[] = {"tree", "table", "bitmap"};
+
+static struct {
+	u8_backend	backend;
+	int			span;		/* 0 means -L */
+} u8cls[4] = {
+	{U8_TREE, 0},
+	{U8_TABLE, 0},		/* Latin, Greek, Cyrillic and Armenian are dense here */
+	{U8_TREE, 0},
+	{U8_BITMAP, 0},		/* few scripts in a huge range */
+};
+
+/* Parses comma separated list of LEN=BACKEND[:SPAN] (i.e. "2=table,3=tree:8") into u8cls */
+static bool
+parse_u8_backends(const char *spec)
+{
+	std::string s(spec);
+	size_t pos = 0;
+	while (pos <= s.size()) {
+		size_t e = s.find(',', pos);
+		std::string item = s.substr(pos, e == std::string::npos ? std::string::npos : e - pos);
+		size_t eq = item.find('='), colon = item.find(':');
+		unsigned len;
+		bool found = false;
+		if (eq != 1 || (len = item[0] - '0') < 1 || len > 4)
+			return false;
+		std::string name = item.substr(2, colon == std::string::npos ? std::string::npos : colon - 2);
+		for (unsigned i = 0; i < sizeof(u8_backend_names) / sizeof(*u8_backend_names); i++) {
+			if (name == u8_backend_names[i]) {
+				u8cls[len - 1].backend = (u8_backend)i;
+				found = true;
+			}
+		}
+		if (!found)
+			return false;
+		u8cls[len - 1].span = colon == std::string::npos ? 0 : atoi(item.c_str() + colon + 1);
+		if (e == std::string::npos)
+			break;
+		pos = e + 1;
+	}
+	return true;
+}
+
+/* Direct table: one range check and one load for every character of the class */
+static void
+gen_u8_table(const casemap &sub, FILE *out, int &branches, int &data)
+{
+	int lo = -1, hi = -1, min = 0, max = 0;
+	for (casemap::const_iterator i = sub.begin(); i != sub.end(); ++i) {
+		if (i->first == i->second)
+			continue;
+		if (lo < 0)
+			lo = i->first;
+		hi = i->first;
+		min = std::min(min, i->second - i->first);
+		max = std::max(max, i->second - i->first);
+	}
+	if (lo >= 0) {
+		bool wide = min < -32768 || max > 32767;
+		char name[64];
+		char c = '{';
+		snprintf(name, sizeof(name), "%s_d%04X_%04X", tbl_prefix, lo, hi);
+		fprintf(out, "\tstatic const %s %s[] = ", wide ? "int" : "short", name);
+		for (int ch = lo; ch <= hi; ch++) {
+			casemap::const_iterator i = sub.find(ch);
+			fprintf(out, "%c%d", c, i == sub.end() ? 0 : i->second - ch);
+			c = ',';
+		}
+		fprintf(out, "};\n");
+		fprintf(out, "\tif ((unsigned)(ic - 0x%04X) <= 0x%04X)\n\t", lo, hi - lo);
+		gen_var_cb(out, "ic + %s[ic - 0x%04X]", name, lo);
+		branches += 1;
+		data += (hi - lo + 1) * (wide ? 4 : 2);
+	}
+	gen_var_cb(out, "ic");
+}
+
+/* Tree behind bitmap with one bit per 64 characters between the first and
+ * the last changed ones, so most characters of the class cost two branches */
+static void
+gen_u8_bitmap(const casemap &sub, FILE *out, unsigned sp, int &height, int &branches, int &data)
+{
+	std::vector<unsigned> bm;
+	map_info mi;
+	int lo = -1, hi = 0;
+	char name[64];
+	char c = '{';
+	for (casemap::const_iterator i = sub.begin(); i != sub.end(); ++i) {
+		if (i->first == i->second)
+			continue;
+		if (lo < 0)
+			lo = i->first & ~63;
+		hi = i->first;
+		bm.resize(((i->first - lo) >> 11) + 1);
+		bm[(i->first - lo) >> 11] |= 1u << (((i->first - lo) >> 6) & 31);
+	}
+	if (lo < 0) {
+		gen_var_cb(out, "ic");
+		return;
+	}
+	snprintf(name, sizeof(name), "%s_b%04X_%04X", tbl_prefix, lo, hi);
+	fprintf(out, "\tstatic const unsigned %s[] = ", name);
+	for (unsigned i = 0; i < bm.size(); i++) {
+		fprintf(out, "%c0x%08X", c, bm[i]);
+		c = ',';
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "\tif ((unsigned)(ic - 0x%04X) > 0x%04X || !(%s[(ic - 0x%04X) >> 11] & 1u << (((ic - 0x%04X) >> 6) & 31)))\n\t",
+			lo, hi - lo, name, lo, lo);
+	gen_var_cb(out, "ic");
+	branches += 2;
+	data += bm.size() * 4;
+	codegen_map(sub.begin(), sub.end(), mi, sp);
+	mi.dump(out, "ic", gen_var_cb);
+	mi.cost(height, branches, data);
 }
 
 static void
 gen_u8_cvt(const casemap &cm, const char *ftmpl)
 {
-	static const struct {
-		unsigned	first, last;
-	} u8r[] = {
+	static const cp_range u8r[] = {
 		{0, 0x7f},
 		{0x80, 0x7ff},
 		{0x800, 0xffff},
 		{0x10000, 0x1fffff}
 	};
 	for (unsigned i = 0; i < sizeof(u8r) / sizeof(*u8r); i++) {
-		casemap::const_iterator b, e;
+		casemap sub = sub_map(cm, u8r + i, 1);
+		unsigned sp = u8cls[i].span ? u8cls[i].span : spanu8;
+		int height = 0, branches = 0, data = 0;
 		char fname[1024];
 		snprintf(fname, sizeof(fname), "%s_%04X_%04X.h", ftmpl, u8r[i].first, u8r[i].last);
 		FILE *out = fopen(fname, "w");
@@ -457,14 +1438,825 @@ gen_u8_cvt(const casemap &cm, const char *ftmpl)
 			exit(EXIT_FAILURE);
 		}
 		fprintf(out, "do {\n");
-		b = cm.lower_bound(u8r[i].first);
-		if (b != cm.end()) {
-			e = cm.upper_bound(u8r[i].last);
-			codegen(b, e, out, "ic", gen_var_cb, spanu8);
+		switch (u8cls[i].backend) {
+		case U8_TREE: {
+			map_info mi;
+			if (codegen_map(sub.begin(), sub.end(), mi, sp)) {
+				mi.dump(out, "ic", gen_var_cb);
+				mi.cost(height, branches, data);
+			}
+			break;
+		}
+		case U8_TABLE:
+			gen_u8_table(sub, out, branches, data);
+			break;
+		case U8_BITMAP:
+			gen_u8_bitmap(sub, out, sp, height, branches, data);
+			break;
 		}
 		fprintf(out, "} while (0);\n");
 		fclose(out);
+		printf("UTF-8 %u byte class %04X-%04X: %s, height %d, %d branches, %d cdata bytes\n",
+				i + 1, u8r[i].first, u8r[i].last, u8_backend_names[u8cls[i].backend],
+				height, branches, data);
+	}
+}
+
+/* Function body like /tmp/x, but folding only characters from "spec" (see -r).
+ * Everything else is returned unchanged, so tree has no branches for it. */
+static void
+gen_range_cvt(const casemap &cm, const char *name, const char *spec)
+{
+	std::vector<cp_range> r;
+	char fname[1024];
+	FILE *out;
+	casemap sub;
+	if (!parse_ranges(spec, r)) {
+		fprintf(stderr, "Invalid range specification: %s\n", spec);
+		exit(EXIT_FAILURE);
+	}
+	sub = sub_map(cm, &r[0], r.size());
+	snprintf(fname, sizeof(fname), "/tmp/x_%s", name);
+	out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* restricted to %s, other characters are returned as is */\n", spec);
+	codegen(sub.begin(), sub.end(), out, "c", gen_ret_cb, span ? span : 12);
+	fclose(out);
+}
+
+/* C++ header with constexpr ucase::fold(), see ucase.hpp */
+static void
+gen_cxx_hdr(const casemap &cm, const char *fname)
+{
+	map_info mi;
+	unsigned cvt;
+	bool packed = packed_tables;
+	FILE *out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	/* constexpr tables stay separate, -a is for C outputs */
+	packed_tables = false;
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"namespace ucase {\n"
+			"namespace detail {\n");
+	cvt = codegen_map(cm.begin(), cm.end(), mi, span ? span : 12);
+	if (cvt)
+		mi.tables(out, "inline constexpr");
+	fprintf(out, "} /* namespace detail */\n\n"
+			"constexpr char32_t\n"
+			"fold(char32_t c) noexcept\n"
+			"{\n"
+			"\tusing namespace detail;\n");
+	if (cvt) {
+		local_tables = false;
+		mi.dump_nested(out, "c", gen_ret_cb);
+		local_tables = true;
+		fprintf(out, "//%d case conversions\n", cvt);
+	}
+	fprintf(out, "\treturn c;\n"
+			"}\n"
+			"} /* namespace ucase */\n");
+	fclose(out);
+	packed_tables = packed;
+}
+
+static int
+u8_enc(unsigned char *dst, int c)
+{
+	if (c <= 0x7F) {
+		dst[0] = c;
+		return 1;
+	} else if (c <= 0x7FF) {
+		dst[0] = 0xC0 | (c >> 6);
+		dst[1] = 0x80 | (c & 0x3F);
+		return 2;
+	} else if (c <= 0xFFFF) {
+		dst[0] = 0xE0 | (c >> 12);
+		dst[1] = 0x80 | ((c >> 6) & 0x3F);
+		dst[2] = 0x80 | (c & 0x3F);
+		return 3;
+	}
+	dst[0] = 0xF0 | (c >> 18);
+	dst[1] = 0x80 | ((c >> 12) & 0x3F);
+	dst[2] = 0x80 | ((c >> 6) & 0x3F);
+	dst[3] = 0x80 | (c & 0x3F);
+	return 4;
+}
+
+/* Byte level UTF-8 folding automaton.
+ *
+ * Every row holds 64 entries indexed by low 6 bits of a continuation byte. Lead byte
+ * selects the first row, rows of inner bytes hold index of the next row, and rows of
+ * the last byte hold the result: either the new last byte (when the rest of sequence
+ * stays the same) or 0x100 + index of the whole folded sequence in exceptions table.
+ * Row 0 is identity for the last byte, rows 1 and 2 are identity for 3- and 4-byte
+ * sequences, so there are no special cases on the hot path. */
+class u8_fsm {
+	const casemap							&m_cm;
+	std::vector<std::vector<unsigned> >		m_rows;
+	std::map<std::vector<unsigned>, unsigned>	m_ids;
+	std::vector<std::vector<unsigned char> >	m_exc;
+	unsigned								m_lead[64];
+
+	unsigned intern(const std::vector<unsigned> &r) {
+		std::map<std::vector<unsigned>, unsigned>::const_iterator i = m_ids.find(r);
+		if (i != m_ids.end())
+			return i->second;
+		m_rows.push_back(r);
+		return m_ids[r] = m_rows.size() - 1;
+	}
+
+	int fold(int c) const {
+		casemap::const_iterator i = m_cm.find(c);
+		return i == m_cm.end() ? c : i->second;
+	}
+
+	/* Row for the last byte of characters [base, base + 63] */
+	unsigned leaf(int base) {
+		std::vector<unsigned> r(64);
+		for (int i = 0; i < 64; i++) {
+			unsigned char in[4], o[4];
+			int n = u8_enc(in, base + i), k = u8_enc(o, fold(base + i));
+			if (n == k && memcmp(in, o, n - 1) == 0) {
+				r[i] = o[n - 1];
+			} else {
+				r[i] = 0x100 + m_exc.size();
+				m_exc.push_back(std::vector<unsigned char>(o, o + k));
+			}
+		}
+		return intern(r);
+	}
+
+	/* Row for the inner byte, "shift" is bit position of the byte being indexed */
+	unsigned inner(int base, int shift) {
+		std::vector<unsigned> r(64);
+		for (int i = 0; i < 64; i++) {
+			int b = base | (i << shift);
+			r[i] = shift == 6 ? leaf(b) : inner(b, shift - 6);
+		}
+		return intern(r);
+	}
+public:
+	u8_fsm(const casemap &cm) : m_cm(cm) {
+		std::vector<unsigned> r(64);
+		for (int i = 0; i < 64; i++)
+			r[i] = 0x80 | i;
+		intern(r);
+		r.assign(64, 0);
+		intern(r);
+		r.assign(64, 1);
+		intern(r);
+		for (int b = 0xC0; b <= 0xFF; b++) {
+			if (b < 0xE0)
+				m_lead[b - 0xC0] = leaf((b & 0x1F) << 6);
+			else if (b < 0xF0)
+				m_lead[b - 0xC0] = inner((b & 0x0F) << 12, 6);
+			else if (b < 0xF8)
+				m_lead[b - 0xC0] = inner((b & 0x07) << 18, 12);
+			else
+				m_lead[b - 0xC0] = 2;
+		}
+	}
+
+	void dump(FILE *out) const {
+		char c = '{';
+		unsigned data = sizeof(m_lead) / 2 + 128 + m_rows.size() * 64 * 2 + m_exc.size() * 4;
+		fprintf(out, "/* %u rows, %u exceptions, %u cdata bytes */\n",
+				(unsigned)m_rows.size(), (unsigned)m_exc.size(), data);
+		fprintf(out, "static const unsigned char u8f_ascii[128] = ");
+		for (int i = 0; i < 128; i++) {
+			fprintf(out, "%c0x%02X", c, fold(i));
+			c = ',';
+		}
+		fprintf(out, "};\n");
+		c = '{';
+		fprintf(out, "static const unsigned short u8f_lead[64] = ");
+		for (int i = 0; i < 64; i++) {
+			fprintf(out, "%c%u", c, m_lead[i]);
+			c = ',';
+		}
+		fprintf(out, "};\n");
+		fprintf(out, "static const unsigned short u8f_row[][64] = {\n");
+		for (unsigned i = 0; i < m_rows.size(); i++) {
+			c = '{';
+			for (unsigned j = 0; j < 64; j++) {
+				fprintf(out, "%c0x%02X", c, m_rows[i][j]);
+				c = ',';
+			}
+			fprintf(out, "},\n");
+		}
+		fprintf(out, "};\n");
+		fprintf(out, "static const unsigned char u8f_exc[][4] = {\n");
+		for (unsigned i = 0; i < m_exc.size(); i++) {
+			c = '{';
+			for (unsigned j = 0; j < m_exc[i].size(); j++) {
+				fprintf(out, "%c0x%02X", c, m_exc[i][j]);
+				c = ',';
+			}
+			fprintf(out, "},\n");
+		}
+		if (m_exc.empty())
+			fprintf(out, "{0},\n");
+		fprintf(out, "};\n");
+	}
+};
+
+static void
+gen_u8_fsm(const casemap &cm, const char *fname)
+{
+	u8_fsm fsm(cm);
+	FILE *out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"#include <string.h>\n");
+	fsm.dump(out);
+	fprintf(out, "\n"
+			"/* Folds one well formed UTF-8 character at *src into *dst, advances both */\n"
+			"static inline void\n"
+			"u8f_fold_char(const unsigned char **src, unsigned char **dst)\n"
+			"{\n"
+			"\tconst unsigned char *s = *src;\n"
+			"\tunsigned char *d = *dst;\n"
+			"\tunsigned v, n;\n"
+			"\tif (s[0] < 0x80) {\n"
+			"\t\t*d = u8f_ascii[s[0]];\n"
+			"\t\t*src = s + 1;\n"
+			"\t\t*dst = d + 1;\n"
+			"\t\treturn;\n"
+			"\t} else if (s[0] < 0xE0) {\n"
+			"\t\tv = u8f_row[u8f_lead[s[0] - 0xC0]][s[1] & 0x3F];\n"
+			"\t\tn = 2;\n"
+			"\t} else if (s[0] < 0xF0) {\n"
+			"\t\tv = u8f_row[u8f_row[u8f_lead[s[0] - 0xC0]][s[1] & 0x3F]][s[2] & 0x3F];\n"
+			"\t\tn = 3;\n"
+			"\t} else {\n"
+			"\t\tv = u8f_row[u8f_row[u8f_row[u8f_lead[s[0] - 0xC0]][s[1] & 0x3F]][s[2] & 0x3F]][s[3] & 0x3F];\n"
+			"\t\tn = 4;\n"
+			"\t}\n"
+			"\t*src = s + n;\n"
+			"\tif (v < 0x100) {\n"
+			"\t\tmemcpy(d, s, n - 1);\n"
+			"\t\td[n - 1] = v;\n"
+			"\t} else {\n"
+			"\t\tconst unsigned char *e = u8f_exc[v - 0x100];\n"
+			"\t\tn = e[0] < 0x80 ? 1 : e[0] < 0xE0 ? 2 : e[0] < 0xF0 ? 3 : 4;\n"
+			"\t\tmemcpy(d, e, n);\n"
+			"\t}\n"
+			"\t*dst = d + n;\n"
+			"}\n"
+			"\n"
+			"/* Folds len bytes of well formed UTF-8 from in to out and returns resulting length.\n"
+			" * Folded string may be up to 1.5 times longer than the source. */\n"
+			"static inline unsigned\n"
+			"u8f_fold_str(const char *in, unsigned len, char *out)\n"
+			"{\n"
+			"\tconst unsigned char *src = (const unsigned char*)in, *end = src + len;\n"
+			"\tunsigned char *dst = (unsigned char*)out;\n"
+			"\twhile (src < end)\n"
+			"\t\tu8f_fold_char(&src, &dst);\n"
+			"\treturn (char*)dst - out;\n"
+			"}\n");
+	fclose(out);
+}
+
+/* Intervals sorted by first character and their translation data, see ucblob.h */
+static void
+blob_nodes(const casemap &cm, std::vector<ucblob_node> &nodes, std::vector<unsigned> &data)
+{
+	map_info mi;
+	std::vector<case_mapping*> v;
+	codegen_map(cm.begin(), cm.end(), mi, span ? span : 12);
+	mi.mappings(v);
+	nodes.resize(v.size());
+	for (unsigned i = 0; i < v.size(); i++)
+		v[i]->blob(nodes[i], data);
+}
+
+/* The same intervals as C arrays, for code that walks them itself (ucrun.c) */
+static void
+gen_nodes_hdr(const casemap &cm, const char *fname)
+{
+	static const char *kinds[] = {"UCBLOB_XLAT", "UCBLOB_DELTA", "UCBLOB_SET", "UCBLOB_RESET", "UCBLOB_SINGLE"};
+	std::vector<ucblob_node> nodes;
+	std::vector<unsigned> data;
+	FILE *out;
+	blob_nodes(cm, nodes, data);
+	out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"/* %u intervals, %u data values */\n"
+			"static const struct ucblob_node ucase_nodes[] = {\n",
+			(unsigned)nodes.size(), (unsigned)data.size());
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		const ucblob_node &n = nodes[i];
+		fprintf(out, "\t{0x%04X, 0x%04X, %s, %d, 0x%04X, 0x%04X, %u},\n",
+				n.first, n.last, kinds[n.kind], n.arg, n.tbl_first, n.tbl_last, n.tbl);
+	}
+	fprintf(out, "};\nstatic const uint32_t ucase_node_data[%u] = {", (unsigned)data.size() + 1);
+	for (unsigned i = 0; i < data.size(); i++)
+		fprintf(out, "%s0x%04X", i % 16 ? "," : i ? ",\n\t" : "\n\t", data[i]);
+	fprintf(out, "\n};\n");
+	fclose(out);
+}
+
+/* Binary tables for ucblob.c, see ucblob.h for the format */
+static void
+gen_blob(const casemap &cm, const char *fname, unsigned unicode)
+{
+	std::vector<ucblob_node> nodes;
+	std::vector<unsigned> data;
+	ucblob_hdr h;
+	FILE *out;
+	blob_nodes(cm, nodes, data);
+	memset(&h, 0, sizeof(h));
+	h.magic = UCBLOB_MAGIC;
+	h.version = UCBLOB_VERSION;
+	h.unicode = unicode;
+	h.nodes = sizeof(h);
+	h.count = nodes.size();
+	h.data = h.nodes + nodes.size() * sizeof(ucblob_node);
+	h.data_len = data.size();
+	h.size = h.data + data.size() * sizeof(uint32_t);
+	out = fopen(fname, "wb");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fwrite(&h, sizeof(h), 1, out);
+	if (!nodes.empty())
+		fwrite(&nodes[0], sizeof(ucblob_node), nodes.size(), out);
+	for (unsigned i = 0; i < data.size(); i++) {
+		uint32_t d = data[i];
+		fwrite(&d, sizeof(d), 1, out);
+	}
+	if (ferror(out) || fclose(out) != 0) {
+		perror(fname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Storage of tables and functions of header included by C and C++: static in
+ * C, inline in C++, so that inline C++ code (ucfold.hpp) refers to the same
+ * definition in every translation unit */
+static const char *
+cxx_shared(const char *prefix)
+{
+	static char buf[512];
+	snprintf(buf, sizeof(buf), "#ifdef __cplusplus\n"
+			"#define %s_TABLE\tinline constexpr\n"
+			"#define %s_FUNC\tinline\n"
+			"#else\n"
+			"#define %s_TABLE\tstatic const\n"
+			"#define %s_FUNC\tstatic inline\n"
+			"#endif\n", prefix, prefix, prefix, prefix);
+	return buf;
+}
+
+/* Two-level table of BMP deltas of mapping cm. Stage 1 holds offset of 256-entry
+ * block in stage 2 for every high byte, stage 2 holds (map(c) - c) & 0xFFFF, so
+ * that result is (c + delta) & 0xFFFF. Block 0 is identity, equal blocks are
+ * shared. */
+static void
+two_stage_blocks(const casemap &cm, unsigned *stage1, std::vector<std::vector<unsigned> > &blocks)
+{
+	std::map<std::vector<unsigned>, unsigned> ids;
+	blocks.assign(1, std::vector<unsigned>(256, 0));
+	ids[blocks[0]] = 0;
+	for (unsigned hi = 0; hi < 256; hi++) {
+		std::vector<unsigned> b(256);
+		for (unsigned lo = 0; lo < 256; lo++) {
+			int ch = (hi << 8) | lo;
+			casemap::const_iterator i = cm.find(ch);
+			b[lo] = i == cm.end() ? 0 : (i->second - ch) & 0xFFFF;
+		}
+		std::map<std::vector<unsigned>, unsigned>::const_iterator i = ids.find(b);
+		if (i == ids.end()) {
+			stage1[hi] = ids[b] = blocks.size();
+			blocks.push_back(b);
+		} else {
+			stage1[hi] = i->second;
+		}
+	}
+}
+
+/* Writes stage1 as "decl type name_stage1[256]" and stage2 with extra entries at the end */
+static void
+print_two_stage(FILE *out, const char *decl, const char *name, const char *type, const unsigned *stage1,
+		const std::vector<std::vector<unsigned> > &blocks, unsigned extra)
+{
+	char c = '{';
+	fprintf(out, "%s %s %s_stage1[256] = ", decl, type, name);
+	for (unsigned i = 0; i < 256; i++) {
+		fprintf(out, "%c%u", c, stage1[i] * 256);
+		c = ',';
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "%s unsigned short %s_stage2[%u] = {\n", decl, name, (unsigned)blocks.size() * 256 + extra);
+	for (unsigned i = 0; i < blocks.size(); i++) {
+		c = '\t';
+		for (unsigned j = 0; j < 256; j++) {
+			fprintf(out, "%c0x%04X", c, blocks[i][j]);
+			c = ',';
+		}
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "\t%s};\n", extra ? "0" : "");
+}
+
+/* Simple case mappings from UnicodeData.txt: fields 12, 13 and 14 are upper, lower
+ * and title case, empty title case is the same as upper case */
+static void
+read_unicode_data(casemap &upper, casemap &lower, casemap &title)
+{
+	char line[4096];
+	FILE *in = fopen("UnicodeData.txt", "r");
+	if (!in) {
+		fprintf(stderr, "Can't locate UnicodeData.txt file. Exiting.\n");
+		exit(EXIT_FAILURE);
+	}
+	while ((fgets(line, sizeof(line), in))) {
+		char *f[15], *p = line;
+		unsigned n, c;
+		for (n = 0; n < 15 && p; n++) {
+			f[n] = p;
+			p = strchr(p, ';');
+			if (p)
+				*p++ = 0;
+		}
+		if (n < 15 || sscanf(f[0], "%x", &c) != 1)
+			continue;
+		if (*f[12])
+			upper[c] = strtoul(f[12], NULL, 16);
+		if (*f[13])
+			lower[c] = strtoul(f[13], NULL, 16);
+		if (*f[14] && *f[14] != '\n' && *f[14] != '\r')
+			title[c] = strtoul(f[14], NULL, 16);
+		else if (*f[12])
+			title[c] = upper[c];
+	}
+	fclose(in);
+}
+
+/* Header with static ucase_fold(), ucase_tolower(), ucase_toupper() and ucase_totitle().
+ * All functions are built the same way as /tmp/x, their translation tables are
+ * put at file scope so that tables that are the same for several mappings are shared. */
+static void
+gen_casemap_hdr(const casemap &cm, const char *fname)
+{
+	casemap upper, lower, title;
+	static const char *names[] = {"fold", "tolower", "toupper", "totitle"};
+	const casemap *maps[] = {&cm, &lower, &upper, &title};
+	map_info mi[4];
+	unsigned cvt[4];
+	FILE *out;
+	read_unicode_data(upper, lower, title);
+	out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by cf from CaseFolding.txt and UnicodeData.txt, do not edit. */\n");
+	shared_tables.clear();
+	shared_saved = 0;
+	local_tables = false;
+	for (unsigned i = 0; i < 4; i++) {
+		char prefix[32];
+		snprintf(prefix, sizeof(prefix), "ucase_%s", names[i]);
+		tbl_prefix = prefix;
+		cvt[i] = codegen_map(maps[i]->begin(), maps[i]->end(), mi[i], span ? span : 12);
+		if (cvt[i])
+			mi[i].tables(out, "static const");
+	}
+	for (unsigned i = 0; i < 4; i++) {
+		char prefix[32];
+		snprintf(prefix, sizeof(prefix), "ucase_%s", names[i]);
+		tbl_prefix = prefix;
+		fprintf(out, "\nstatic unsigned\nucase_%s(unsigned c)\n{\n", names[i]);
+		if (cvt[i]) {
+			mi[i].dump(out, "c", gen_ret_cb);
+			fprintf(out, "//%d case conversions\n", cvt[i]);
+		}
+		fprintf(out, "\treturn c;\n}\n");
+	}
+	tbl_prefix = "ucase";
+	local_tables = true;
+	fprintf(out, "/* %u cdata bytes saved by sharing tables */\n", shared_saved);
+	/* Flat lower and upper for the LD_PRELOAD shim: per character calls can't
+	 * be inlined into caller's loop, two loads are cheaper than the tree */
+	for (unsigned i = 1; i < 3; i++) {
+		std::vector<std::vector<unsigned> > blocks;
+		unsigned stage1[256];
+		char name[32];
+		for (casemap::const_iterator j = maps[i]->begin(); j != maps[i]->end() && j->first <= 0xFFFF; ++j) {
+			if (j->second > 0xFFFF) {
+				fprintf(stderr, "%s of U+%04X is out of BMP, can't use two-level table\n", names[i], j->first);
+				exit(EXIT_FAILURE);
+			}
+		}
+		two_stage_blocks(*maps[i], stage1, blocks);
+		snprintf(name, sizeof(name), "ucase_%s", names[i]);
+		fprintf(out, "\n/* %u blocks, %u cdata bytes */\n", (unsigned)blocks.size(),
+				(unsigned)(256 * 4 + blocks.size() * 512));
+		print_two_stage(out, "static const", name, "unsigned", stage1, blocks, 0);
+		fprintf(out, "\n/* The same as %s(c) */\n"
+				"static inline unsigned\n%s_flat(unsigned c)\n{\n"
+				"\tif (c > 0xFFFF)\n\t\treturn %s(c);\n"
+				"\treturn (c + %s_stage2[%s_stage1[c >> 8] + (c & 0xFF)]) & 0xFFFF;\n}\n",
+				name, name, name, name, name);
+	}
+	fclose(out);
+}
+
+/* Self-contained header with static inline PREFIX_fold(c) and PREFIX_fold_array()
+ * instead of bare function body, tables are placed at file scope */
+static void
+gen_inline_hdr(const casemap &cm, const char *fname, const char *prefix, const char *type)
+{
+	std::string guard;
+	map_info mi;
+	unsigned cvt;
+	FILE *out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	for (const char *p = prefix; *p; p++)
+		guard += toupper(*p);
+	guard += "_FOLD_H";
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"#ifndef %s\n#define %s\n\n#include <stddef.h>\n#include <stdint.h>\n\n", guard.c_str(), guard.c_str());
+	shared_tables.clear();
+	local_tables = false;
+	tbl_prefix = prefix;
+	cvt = codegen_map(cm.begin(), cm.end(), mi, span ? span : 12);
+	if (cvt)
+		mi.tables(out, "static const");
+	fprintf(out, "\nstatic inline %s\n%s_fold(%s c)\n{\n", type, prefix, type);
+	if (cvt) {
+		mi.dump(out, "c", gen_ret_cb);
+		fprintf(out, "//%d case conversions\n", cvt);
+	}
+	fprintf(out, "\treturn c;\n}\n");
+	fprintf(out, "\nstatic inline void\n%s_fold_array(const %s *in, %s *out, size_t n)\n{\n"
+			"\tsize_t i;\n\tfor (i = 0; i < n; i++)\n\t\tout[i] = %s_fold(in[i]);\n}\n",
+			prefix, type, type, prefix);
+	fprintf(out, "\n#endif /* %s */\n", guard.c_str());
+	tbl_prefix = "ucase";
+	local_tables = true;
+	fclose(out);
+}
+
+/* Two-level table of BMP folding deltas for gather based UTF-32 kernel (ucu32.c) */
+static void
+gen_gather_tbl(const casemap &cm, const char *fname)
+{
+	std::vector<std::vector<unsigned> > blocks;
+	unsigned stage1[256];
+	FILE *out;
+	two_stage_blocks(cm, stage1, blocks);
+	out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"/* %u blocks, %u cdata bytes */\n",
+			(unsigned)blocks.size(), (unsigned)(256 * 4 + blocks.size() * 512 + 2));
+	fprintf(out, "%s", cxx_shared("UCG"));
+	/* 32-bit gather of the last entry reads one more */
+	print_two_stage(out, "UCG_TABLE", "ucg", "int", stage1, blocks, 1);
+	fclose(out);
+}
+
+/* Branch-free folding: intervals and gaps between them become segments with
+ * (c | orbit) + delta or translation table, segment is found by fixed number of
+ * masked binary search steps and results are selected by mask, so the same
+ * instructions run for every input. */
+struct cmov_segment {
+	unsigned	first;
+	unsigned	orbit;
+	int			delta;
+	unsigned	tbl;	/* data index of the first character + 1, 0 for computed */
+};
+
+static void
+cmov_add(std::vector<cmov_segment> &seg, unsigned first, unsigned orbit, int delta, unsigned tbl)
+{
+	cmov_segment s = {first, orbit, delta, tbl};
+	seg.push_back(s);
+}
+
+static void
+gen_cmov_hdr(const casemap &cm, const char *fname)
+{
+	std::vector<ucblob_node> nodes;
+	std::vector<unsigned> data, tbl(1, 0);
+	std::vector<cmov_segment> seg;
+	unsigned next = 0, size = 1, levels = 0;
+	FILE *out;
+	blob_nodes(cm, nodes, data);
+	for (unsigned i = 0; i < nodes.size(); i++) {
+		const ucblob_node &n = nodes[i];
+		unsigned orbit = 0, tf = n.tbl_first, tl = n.tbl_last, base = tbl.size() + 1;
+		int delta = 0;
+		if (n.first > next)
+			cmov_add(seg, next, 0, 0, 0);
+		switch (n.kind) {
+		case UCBLOB_DELTA:
+			delta = n.arg;
+			break;
+		case UCBLOB_SET:
+			orbit = 1;
+			break;
+		case UCBLOB_RESET:
+			/* c & ~1 == (c | 1) - 1 */
+			orbit = 1;
+			delta = -1;
+			break;
+		case UCBLOB_SINGLE:
+			if (n.first == n.last) {
+				delta = n.arg - n.first;
+				break;
+			}
+			/* fall through */
+		default:
+			/* Whole interval is table */
+			for (unsigned c = n.first; c <= n.last; c++)
+				tbl.push_back(c >= tf && c <= tl ? data[n.tbl + c - tf] :
+						n.kind == UCBLOB_SINGLE ? n.arg : c);
+			cmov_add(seg, n.first, 0, 0, base);
+			next = n.last + 1;
+			continue;
+		}
+		if (tf > tl) {
+			cmov_add(seg, n.first, orbit, delta, 0);
+		} else {
+			if (tf > n.first)
+				cmov_add(seg, n.first, orbit, delta, 0);
+			for (unsigned c = tf; c <= tl; c++)
+				tbl.push_back(data[n.tbl + c - tf]);
+			cmov_add(seg, tf, 0, 0, base);
+			if (tl < n.last)
+				cmov_add(seg, tl + 1, orbit, delta, 0);
+		}
+		next = n.last + 1;
+	}
+	cmov_add(seg, next, 0, 0, 0);
+	while (size < seg.size()) {
+		size <<= 1;
+		levels++;
 	}
+	/* Search takes power of 2 segments, padding is identity from 0xFFFFFFFF */
+	while (seg.size() < size)
+		cmov_add(seg, 0xFFFFFFFFu, 0, 0, 0);
+	out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"/* %u segments, %u levels, %u data bytes */\n",
+			size, levels, (unsigned)(size * 16 + tbl.size() * 4));
+	fprintf(out, "%s", cxx_shared("UCBF"));
+	fprintf(out, "UCBF_TABLE unsigned ucbf_first[%u] = {", size);
+	for (unsigned i = 0; i < size; i++)
+		fprintf(out, "%s0x%04X", i % 16 ? "," : i ? ",\n\t" : "\n\t", seg[i].first);
+	fprintf(out, "\n};\n"
+			"UCBF_TABLE struct ucbf_segment {\n"
+			"\tunsigned\torbit;\n"
+			"\tint\t\tdelta;\n"
+			"\tunsigned\ttbl;\n"
+			"} ucbf_seg[%u] = {\n", (unsigned)seg.size());
+	for (unsigned i = 0; i < seg.size(); i++)
+		fprintf(out, "\t{%u, %d, %u},\n", seg[i].orbit, seg[i].delta, seg[i].tbl);
+	fprintf(out, "};\n"
+			"/* Entry 0 is read by computed segments and thrown away */\n"
+			"UCBF_TABLE unsigned ucbf_data[%u] = {", (unsigned)tbl.size());
+	for (unsigned i = 0; i < tbl.size(); i++)
+		fprintf(out, "%s0x%04X", i % 16 ? "," : i ? ",\n\t" : "\n\t", tbl[i]);
+	fprintf(out, "\n};\n\n"
+			"UCBF_FUNC unsigned\n"
+			"ucbf_fold(unsigned c)\n"
+			"{\n"
+			"\tunsigned k = 0, m, r;\n");
+	for (unsigned half = size >> 1; half; half >>= 1)
+		fprintf(out, "\tk += %u & -(unsigned)(ucbf_first[k + %u] <= c);\n", half, half);
+	fprintf(out, "\tm = -(unsigned)(ucbf_seg[k].tbl != 0);\n"
+			"\tr = ucbf_data[(c - ucbf_first[k] + ucbf_seg[k].tbl - 1) & m];\n"
+			"\treturn (((c | ucbf_seg[k].orbit) + ucbf_seg[k].delta) & ~m) | (r & m);\n"
+			"}\n");
+	fclose(out);
+}
+
+/* Inverse of folding: characters that fold to the same one form a class, which
+ * is stored folded character first. Two-level table maps every member of a
+ * nontrivial class to class number + 1, equal 256-entry blocks are shared. */
+static void
+gen_closure_tbl(const casemap &cm, const char *fname)
+{
+	std::map<int, std::vector<int> > cls;
+	std::map<int, unsigned> id;
+	std::vector<std::vector<unsigned> > blocks(1, std::vector<unsigned>(256, 0));
+	std::map<std::vector<unsigned>, unsigned> ids;
+	std::vector<unsigned> stage1, start(1, 0);
+	std::vector<int> members;
+	unsigned max = 0, limit;
+	for (casemap::const_iterator i = cm.begin(); i != cm.end(); ++i)
+		cls[i->second].push_back(i->first);
+	for (std::map<int, std::vector<int> >::iterator i = cls.begin(); i != cls.end(); ++i) {
+		std::vector<int> &v = i->second;
+		std::sort(v.begin(), v.end());
+		v.insert(v.begin(), i->first);
+		for (unsigned j = 0; j < v.size(); j++)
+			id[v[j]] = start.size();
+		members.insert(members.end(), v.begin(), v.end());
+		start.push_back(members.size());
+		if (v.size() > max)
+			max = v.size();
+	}
+	limit = (id.rbegin()->first | 0xFF) + 1;
+	ids[blocks[0]] = 0;
+	for (unsigned hi = 0; hi < limit >> 8; hi++) {
+		std::vector<unsigned> b(256, 0);
+		for (unsigned lo = 0; lo < 256; lo++) {
+			std::map<int, unsigned>::const_iterator i = id.find((hi << 8) | lo);
+			if (i != id.end())
+				b[lo] = i->second;
+		}
+		std::map<std::vector<unsigned>, unsigned>::const_iterator i = ids.find(b);
+		if (i == ids.end()) {
+			stage1.push_back(ids[b] = blocks.size());
+			blocks.push_back(b);
+		} else {
+			stage1.push_back(i->second);
+		}
+	}
+	/* Offsets of blocks, class numbers and member indexes fit in 16 bits with
+	 * any Unicode version so far, wider ones are used when they stop to */
+	unsigned w1 = (blocks.size() - 1) * 256 > 0xFFFF ? 4 : 2;
+	unsigned w2 = start.size() > 0xFFFF ? 4 : 2;
+	unsigned ws = members.size() > 0xFFFF ? 4 : 2;
+	const char *t1 = w1 > 2 ? "unsigned" : "unsigned short";
+	const char *t2 = w2 > 2 ? "unsigned" : "unsigned short";
+	const char *ts = ws > 2 ? "unsigned" : "unsigned short";
+	FILE *out = fopen(fname, "w");
+	if (!out) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(out, "/* Generated by cf from CaseFolding.txt, do not edit. */\n"
+			"/* %u classes, %u blocks, %u cdata bytes */\n"
+			"#define UCC_MAX\t%u\t/* largest class */\n"
+			"#define UCC_LIMIT\t0x%X\t/* no classes above */\n",
+			(unsigned)cls.size(), (unsigned)blocks.size(),
+			(unsigned)(stage1.size() * w1 + blocks.size() * 256 * w2 + start.size() * ws + members.size() * 4),
+			max, limit);
+	fprintf(out, "static const %s ucc_stage1[%u] = {", t1, (unsigned)stage1.size());
+	for (unsigned i = 0; i < stage1.size(); i++)
+		fprintf(out, "%s%u", i ? "," : "", stage1[i] * 256);
+	fprintf(out, "};\nstatic const %s ucc_stage2[%u] = {\n", t2, (unsigned)blocks.size() * 256);
+	for (unsigned i = 0; i < blocks.size(); i++) {
+		char c = '\t';
+		for (unsigned j = 0; j < 256; j++) {
+			fprintf(out, "%c%u", c, blocks[i][j]);
+			c = ',';
+		}
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "};\nstatic const %s ucc_start[%u] = {", ts, (unsigned)start.size());
+	for (unsigned i = 0; i < start.size(); i++)
+		fprintf(out, "%s%u", i % 32 ? "," : i ? ",\n\t" : "\n\t", start[i]);
+	fprintf(out, "\n};\nstatic const unsigned ucc_members[%u] = {", (unsigned)members.size());
+	for (unsigned i = 0; i < members.size(); i++)
+		fprintf(out, "%s0x%04X", i % 16 ? "," : i ? ",\n\t" : "\n\t", members[i]);
+	fprintf(out, "\n};\n\n"
+			"/* Stores all characters that fold to the same character as c (folded one\n"
+			" * first, c included) into out[UCC_MAX] and returns their number */\n"
+			"static inline unsigned\n"
+			"ucc_closure(unsigned c, unsigned *out)\n"
+			"{\n"
+			"\tunsigned k = c < UCC_LIMIT ? ucc_stage2[ucc_stage1[c >> 8] + (c & 0xFF)] : 0, i, n;\n"
+			"\tif (!k) {\n"
+			"\t\tout[0] = c;\n"
+			"\t\treturn 1;\n"
+			"\t}\n"
+			"\tn = ucc_start[k] - ucc_start[k - 1];\n"
+			"\tfor (i = 0; i < n; i++)\n"
+			"\t\tout[i] = ucc_members[ucc_start[k - 1] + i];\n"
+			"\treturn n;\n"
+			"}\n");
+	fclose(out);
 }
 
 static casemap cm;
@@ -474,9 +2266,15 @@ int main(int argc, char **argv)
 	int c;
 	FILE *in;
 	char line[4096];
+	const char *cxx_hdr = NULL, *u8_fsm_hdr = NULL, *blob = NULL, *casemap_hdr = NULL;
+	const char *gather_tbl = NULL, *prof_hdr = NULL, *nodes_hdr = NULL, *closure_tbl = NULL;
+	const char *cmov_hdr = NULL;
+	const char *inline_hdr = NULL, *inline_prefix = "ucase", *inline_type = "unsigned";
+	unsigned unicode = 0;
+	std::vector<std::string> restrict;
 
 	while (1) {
-		c = getopt(argc, argv, "l:L:dDsSxXyY");
+		c = getopt(argc, argv, "l:L:U:p:i:Ow:H:P:T:eaMn:c:B:k:u:r:b:m:g:dDsSxXyY");
 		if (c == -1)
 			break;
 		switch (c) {
@@ -486,6 +2284,76 @@ int main(int argc, char **argv)
 		case 'L':
 			spanu8 = atoi(optarg);
 			break;
+		case 'U':
+			if (!parse_u8_backends(optarg)) {
+				fprintf(stderr, "Invalid backend specification: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'p':
+			if (!parse_ranges(optarg, prio)) {
+				fprintf(stderr, "Invalid range specification: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'i':
+			prof_hdr = optarg;
+			break;
+		case 'O':
+			optimize = true;
+			break;
+		case 'w':
+			branch_cost = atoi(optarg);
+			break;
+		case 'H':
+			inline_hdr = optarg;
+			break;
+		case 'P':
+			inline_prefix = optarg;
+			break;
+		case 'T':
+			inline_type = optarg;
+			break;
+		case 'e':
+			delta_tables = true;
+			break;
+		case 'a':
+			packed_tables = true;
+			break;
+		case 'M':
+			mask_ex = true;
+			break;
+		case 'n':
+			nodes_hdr = optarg;
+			break;
+		case 'c':
+			closure_tbl = optarg;
+			break;
+		case 'B':
+			cmov_hdr = optarg;
+			break;
+		case 'k':
+			cxx_hdr = optarg;
+			break;
+		case 'u':
+			u8_fsm_hdr = optarg;
+			break;
+		case 'g':
+			gather_tbl = optarg;
+			break;
+		case 'm':
+			casemap_hdr = optarg;
+			break;
+		case 'b':
+			blob = optarg;
+			break;
+		case 'r':
+			if (!strchr(optarg, '=')) {
+				fprintf(stderr, "Range must be specified as NAME=SPEC\n");
+				exit(EXIT_FAILURE);
+			}
+			restrict.push_back(optarg);
+			break;
 		case 'd':
 			allow_delta = true; break;
 		case 'D':
@@ -515,15 +2383,40 @@ int main(int argc, char **argv)
 	}
 	while ((fgets(line, sizeof(line), in))) {
 		int c1, c2;
+		unsigned v[3];
 		char type;
+		if (sscanf(line, "# CaseFolding-%u.%u.%u.txt", v, v + 1, v + 2) == 3)
+			unicode = (v[0] << 16) | (v[1] << 8) | v[2];
 		if (sscanf(line, "%x; %c; %x", &c1, &type, &c2) == 3 && (type == 'S' || type == 'C')) {
 			cm[c1] = c2;
 		}
 	}
 	fclose(in);
 	if (span)
-		gen_u_cvt(cm, "/tmp/x");
+		gen_u_cvt(cm, "/tmp/x", prof_hdr);
 	if (spanu8)
 		gen_u8_cvt(cm, "/tmp/u");
+	if (cxx_hdr)
+		gen_cxx_hdr(cm, cxx_hdr);
+	if (u8_fsm_hdr)
+		gen_u8_fsm(cm, u8_fsm_hdr);
+	if (blob)
+		gen_blob(cm, blob, unicode);
+	if (nodes_hdr)
+		gen_nodes_hdr(cm, nodes_hdr);
+	if (casemap_hdr)
+		gen_casemap_hdr(cm, casemap_hdr);
+	if (gather_tbl)
+		gen_gather_tbl(cm, gather_tbl);
+	if (closure_tbl)
+		gen_closure_tbl(cm, closure_tbl);
+	if (cmov_hdr)
+		gen_cmov_hdr(cm, cmov_hdr);
+	if (inline_hdr)
+		gen_inline_hdr(cm, inline_hdr, inline_prefix, inline_type);
+	for (unsigned i = 0; i < restrict.size(); i++) {
+		std::string name = restrict[i].substr(0, restrict[i].find('='));
+		gen_range_cvt(cm, name.c_str(), restrict[i].c_str() + name.size() + 1);
+	}
 	return 0;
 }
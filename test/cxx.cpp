@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "../ucase.hpp"
+#include "../ucmap.hpp"
+#include "../ucfold.hpp"
+
+static_assert(ucase::fold(U'A') == U'a', "ASCII");
+static_assert(ucase::fold(0x0410) == 0x0430, "Cyrillic");
+static_assert(ucase::fold(0x212A) == U'k', "Kelvin sign");
+static_assert(ucase::fold_literal("Hello, МИР").view() == "hello, мир", "literal");
+static_assert(ucase::fold_hash("Content-Type") == ucase::fold_hash("CONTENT-TYPE"), "hash");
+static_assert(ucase::fold_equal("Straße", "STRAßE"), "equal");
+/* Malformed bytes are kept as is and never match characters */
+static_assert(!ucase::fold_equal("\xC4", "\xC3\x84"), "lone byte");
+static_assert(!ucase::fold_equal("\xC3" "A", "\xC3\x81"), "bad continuation");
+static_assert(!ucase::fold_equal("\xC0\xC1", "A"), "overlong");
+static_assert(!ucase::fold_equal("\xED\xA0\x80", "\xF0\x90\x80\x80"), "surrogate");
+static_assert(ucase::fold_equal("\xFF" "A", "\xFF" "a"), "bytes around bad one");
+static_assert(ucase::fold_hash("\xC4") != ucase::fold_hash("\xC3\xA4"), "hash of lone byte");
+static_assert(ucase::fold_literal("\xFF\xFF\xFF\xFF\xFF\xFF").view() == "\xFF\xFF\xFF\xFF\xFF\xFF", "bytes copied");
+static_assert(ucase::fold_literal("\xC3" "A\xE2\x84").view() == "\xC3" "a\xE2\x84", "truncated");
+
+unsigned ucase_tree(unsigned c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+static int
+keyword(std::string_view s)
+{
+	switch (ucase::fold_hash(s)) {
+	case ucase::fold_hash("select"):
+		return 1;
+	case ucase::fold_hash("from"):
+		return 2;
+	}
+	return 0;
+}
+
+/* Keys in mixed case and scripts, every one looked up in other spellings,
+ * half of them erased; enough of them to rehash several times */
+static unsigned
+test_flat_map(void)
+{
+	static const char *stems[] = {"Content-Type", "ΣΊΣΥΦΟΣ", "Straße", "Привет", "\xE2\x84\xAA-key"};
+	static const char *other[] = {"content-type", "σίσυφος", "STRASSE", "пРИВЕТ", "k-KEY"};
+	ucase::flat_map<std::string, unsigned> m;
+	ucase::flat_set<> set;
+	unsigned i, err = 0, n = 5000;
+	for (i = 0; i < n; i++) {
+		std::string k = std::string(stems[i % 5]) + std::to_string(i);
+		if (!m.insert(k, i).second || !set.insert(k))
+			err++;
+	}
+	for (i = 0; i < n; i++) {
+		std::string k = std::string(other[i % 5]) + std::to_string(i);
+		const unsigned *v = m.find(k);
+		bool same = i % 5 != 2;	/* no full folding: ß does not match SS */
+		if ((v != nullptr) != same || (v && *v != i) || set.contains(k) != same)
+			err++;
+		if (m.insert(std::string(stems[i % 5]) + std::to_string(i), 0).second)
+			err++;
+	}
+	for (i = 0; i < n; i += 2)
+		if (!m.erase(std::string(stems[i % 5]) + std::to_string(i)))
+			err++;
+	for (i = 0; i < n; i++)
+		if ((m.find(std::string(stems[i % 5]) + std::to_string(i)) != nullptr) != (i & 1))
+			err++;
+	m["FROM"] = 7;
+	if (m.size() != n / 2 + 1 || set.size() != n || m["from"] != 7)
+		err++;
+	if (err)
+		printf("Error in flat_map: %u mismatches\n", err);
+	return err;
+}
+
+struct ref_backend {
+	static char32_t fold(char32_t c) noexcept {
+		return ucase_tree(c);
+	}
+};
+
+/* Every BMP unit in order (surrogates make pairs only at DBFF DC00) and random
+ * strings of ASCII runs, BMP letters, pairs and lone surrogates, folded by every
+ * backend and by dispatched kernel */
+static unsigned
+test_fold_u16(void)
+{
+	static const char16_t abc[] = {u'a', u'Z', 0x212A, 0x017F, 0x023A, 0x042F, 0x0451, 0x1E9E, 0xFF21,
+		0xD801, 0xDC00, 0xD801, 0xDC27, 0xDC00, 0xD800};
+	std::u16string in, ref, out;
+	unsigned t, i, err = 0;
+	srand(7);
+	for (t = 0; t < 1000; t++) {
+		in.clear();
+		if (!t) {
+			for (i = 0; i < 0x10000; i++)
+				in.push_back(i);
+		} else {
+			while (in.size() < 300) {
+				if (rand() % 3)
+					for (i = rand() % 40; i; i--)
+						in.push_back(u'A' + rand() % 58);
+				else
+					in.push_back(abc[rand() % (sizeof(abc) / sizeof(*abc))]);
+			}
+		}
+		ucase::fold<ref_backend>(in, ref);
+		ucase::fold<ucase::backend::tree>(in, out);
+		err += out != ref;
+		ucase::fold<ucase::backend::two_stage>(in, out);
+		err += out != ref;
+		ucase::fold<ucase::backend::branch_free>(in, out);
+		err += out != ref;
+		ucase::fold<ucase::backend::eytzinger>(in, out);
+		err += out != ref;
+		ucase::fold(in, out);
+		err += out != ref;
+	}
+	if (err)
+		printf("Error in UTF-16 fold (%s kernel): %u mismatches\n", ucase_fold_u16_kernel(), err);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned i, err = 0;
+	for (i = 0; i < 0x1FFFFF; i++) {
+		if (ucase::fold(i) != ucase_tree(i)) {
+			printf("Error in constexpr fold U+%04X:\n"
+					"  tree:      U+%04X\n"
+					"  constexpr: U+%04X\n", i, ucase_tree(i), (unsigned)ucase::fold(i));
+			err++;
+		}
+	}
+	if (keyword("SeLeCt") != 1 || keyword("FROM") != 2 || keyword("where") != 0) {
+		printf("Error in fold_hash keyword dispatch\n");
+		err++;
+	}
+	err += test_flat_map();
+	err += test_fold_u16();
+	if (err)
+		printf("Total %u errors detected\n", err);
+	else
+		printf("constexpr folding is correct\n");
+	return err != 0;
+}
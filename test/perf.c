@@ -8,6 +8,11 @@
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include "../ucfind.h"
+#include "../ucu32.h"
+#include "../ucrun.h"
+#include "/tmp/uci.h"
+#include "/tmp/ucbf.h"
 
 /** Returns difference between stop and start in microseconds */
 unsigned
@@ -81,6 +86,110 @@ fold_u16_icu(const void *p, unsigned len)
 	return out;
 }
 
+/* Counts case insensitive matches of needle: fold whole text, then search it */
+unsigned
+find_u16_folded(const void *p, unsigned len, const char *needle)
+{
+	unsigned i, cnt = 0, nl = 0;
+	uint16_t n[256];
+	uint16_t *f = (uint16_t*)fold_u16_my(p, len);
+	const unsigned char *s = (const unsigned char*)needle;
+	/* Needle is UTF-8, only BMP characters are expected */
+	while (*s && nl < 256) {
+		unsigned c = *s++;
+		if (c >= 0xE0) {
+			c = ((c & 0x0F) << 12) | ((s[0] & 0x3F) << 6) | (s[1] & 0x3F);
+			s += 2;
+		} else if (c >= 0xC0) {
+			c = ((c & 0x1F) << 6) | (s[0] & 0x3F);
+			s++;
+		}
+		n[nl++] = my_fold(c);
+	}
+	len >>= 1;
+	for (i = 0; nl && i + nl <= len; i++) {
+		if (f[i] == n[0] && memcmp(f + i, n, nl * 2) == 0)
+			cnt++;
+	}
+	free(f);
+	return cnt;
+}
+
+/* The same without folding text, see ucfind.c */
+unsigned
+find_u16_ucase(const void *p, unsigned len, const char *needle)
+{
+	const uint16_t *h = (const uint16_t*)p;
+	unsigned cnt = 0;
+	size_t pos = 0, ml;
+	long r;
+	ucase_needle *n = ucase_needle_u8(needle, strlen(needle));
+	len >>= 1;
+	while (pos < len && (r = ucase_find_u16(n, h + pos, len - pos, &ml)) >= 0) {
+		cnt++;
+		pos += r + 1;
+	}
+	ucase_needle_free(n);
+	return cnt;
+}
+
+/* UTF-32 folding: scalar tree vs inline header ("cf -H") vs ucase_fold_u32(), text is widened from UTF-16
+ * code units (surrogates are left as is by both) */
+void
+fold_u32_cmp(const void *p, unsigned len)
+{
+	struct timespec t[2];
+	unsigned i, ms, n = len >> 1;
+	const uint16_t *in = (const uint16_t*)p;
+	uint32_t *w = (uint32_t*)malloc(n * 4), *out[2];
+	out[0] = (uint32_t*)malloc(n * 4);
+	out[1] = (uint32_t*)malloc(n * 4);
+	for (i = 0; i < n; i++)
+		w[i] = in[i];
+	/* Page faults should not be counted against the first run */
+	memset(out[0], 0, n * 4);
+	memset(out[1], 0, n * 4);
+
+	clock_gettime(CLOCK_MONOTONIC, t);
+	for (i = 0; i < n; i++)
+		out[0][i] = my_fold(w[i]);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	ms = clock_diff(t, t + 1);
+	printf("u32 tree   took %u.%06u\n", ms / 1000000, ms % 1000000);
+
+	clock_gettime(CLOCK_MONOTONIC, t);
+	uci_fold_array(w, out[1], n);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	ms = clock_diff(t, t + 1);
+	printf("u32 inline took %u.%06u (%s)\n", ms / 1000000, ms % 1000000,
+			memcmp(out[0], out[1], n * 4) ? "mismatch" : "same");
+
+	clock_gettime(CLOCK_MONOTONIC, t);
+	ucase_fold_u32(w, out[1], n);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	ms = clock_diff(t, t + 1);
+	printf("u32 gather took %u.%06u (%s)\n", ms / 1000000, ms % 1000000,
+			memcmp(out[0], out[1], n * 4) ? "mismatch" : "same");
+
+	clock_gettime(CLOCK_MONOTONIC, t);
+	ucase_fold_u32_run(w, out[1], n);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	ms = clock_diff(t, t + 1);
+	printf("u32 run    took %u.%06u (%s)\n", ms / 1000000, ms % 1000000,
+			memcmp(out[0], out[1], n * 4) ? "mismatch" : "same");
+
+	clock_gettime(CLOCK_MONOTONIC, t);
+	for (i = 0; i < n; i++)
+		out[1][i] = ucbf_fold(w[i]);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	ms = clock_diff(t, t + 1);
+	printf("u32 cmov   took %u.%06u (%s)\n", ms / 1000000, ms % 1000000,
+			memcmp(out[0], out[1], n * 4) ? "mismatch" : "same");
+	free(w);
+	free(out[0]);
+	free(out[1]);
+}
+
 int main(int argc, char **argv)
 {
 	struct timespec t[2];
@@ -113,6 +222,23 @@ int main(int argc, char **argv)
 	ms = clock_diff(t, t + 1);
 	printf("icu_fold took %u.%06u\n", ms / 1000000, ms % 1000000);
 
+	fold_u32_cmp(in, len);
+
+	if (argc > 1) {
+		unsigned cnt[2];
+		clock_gettime(CLOCK_MONOTONIC, t);
+		cnt[0] = find_u16_folded(in, len, argv[1]);
+		clock_gettime(CLOCK_MONOTONIC, t + 1);
+		ms = clock_diff(t, t + 1);
+		printf("fold+search took %u.%06u (%u matches)\n", ms / 1000000, ms % 1000000, cnt[0]);
+
+		clock_gettime(CLOCK_MONOTONIC, t);
+		cnt[1] = find_u16_ucase(in, len, argv[1]);
+		clock_gettime(CLOCK_MONOTONIC, t + 1);
+		ms = clock_diff(t, t + 1);
+		printf("ucase_find  took %u.%06u (%u matches)\n", ms / 1000000, ms % 1000000, cnt[1]);
+	}
+
 	if (memcmp(out[0], out[1], len) == 0) {
 		printf("Results are the same\n");
 	} else {
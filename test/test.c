@@ -1,7 +1,28 @@
 #include <stdio.h>
 #include <string.h>
 #include <unicode/uchar.h>
+#include <unicode/ustring.h>
 #include <ctype.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "/tmp/u8f.h"
+#include "../ucblob.h"
+#include "../ucfind.h"
+#include "../ucmatch.h"
+#include "../uctrie.h"
+#include "../ucbatch.h"
+#include "../ucu32.h"
+#include "../ucrun.h"
+#include "../ucu8.h"
+#include "/tmp/ucc.h"
+#include "/tmp/ucbf.h"
+#include "../ucprof.h"
+#include "/tmp/uci.h"
+#include "/tmp/ucr.h"
+#include "/tmp/ucro.h"
+#ifdef HAVE_CASEMAP
+#include "/tmp/ucase_map.h"
+#endif
 
 static unsigned cmp;
 
@@ -11,6 +32,12 @@ unsigned ucase(unsigned c)
 	return c;
 }
 
+unsigned ucase_bmp(unsigned c)
+{
+#	include "/tmp/x_bmp"
+	return c;
+}
+
 #if 0
 unsigned utf8_casefold_str(const char *in, unsigned len, char *out, unsigned out_size)
 {
@@ -79,6 +106,19 @@ unsigned utf8_casefold_char(const char *in)
 	return oc;
 }
 
+static unsigned
+u8_dec(const char *in)
+{
+	const unsigned char *src = (const unsigned char *)in;
+	if (src[0] < 0x80)
+		return src[0];
+	else if ((src[0] & 0xE0) == 0xC0)
+		return ((src[0] & 0x1F) << 6) | (src[1] & 0x3F);
+	else if ((src[0] & 0xF0) == 0xE0)
+		return ((src[0] & 0x0F) << 12) | ((src[1] & 0x3F) << 6) | (src[2] & 0x3F);
+	return ((src[0] & 0x07) << 18) | ((src[1] & 0x3F) << 12) | ((src[2] & 0x3F) << 6) | (src[3] & 0x3F);
+}
+
 static void
 u8_enc(char *out, unsigned oc)
 {
@@ -100,20 +140,601 @@ u8_enc(char *out, unsigned oc)
 	}
 }
 
+static unsigned
+u8_len(unsigned c)
+{
+	return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+}
+
+/* Compares ucase_find_u8/u16 with naive search over folded code points
+ * on random strings built of characters with tricky case forms */
+static unsigned
+test_find(void)
+{
+	static const struct {
+		const char	*needle, *hay;
+		long		at;
+	} bad[] = {
+		{"\xC3\xA1\xC3\xA1", "\xC3\xA1\xC3" "A", -1},
+		{"\xC3\xA1", "x\xC3" "Ay", -1},
+		{"\xC3" "a", "x\xC3" "Ay", 1},
+		{"\xA1", "\xC3\xA1x\xA1", 3},
+		{"\xE0\x81\x81", "\xE0\x81\x61\xE0\x81\x81", 3},
+	};
+	static const unsigned abc[] = {'a', 'A', 'k', 'K', 0x212A, 's', 'S', 0x017F, 0x044F, 0x042F,
+		0x00DF, 0x1E9E, 0x10400, 0x10428, 0x03C3, 0x03A3, 0x03C2, ' '};
+	unsigned t, err = 0, n = sizeof(abc) / sizeof(*abc);
+	srand(1);
+	for (t = 0; t < 20000; t++) {
+		unsigned hay[64], ndl[6], hl = rand() % 64, nl = 1 + rand() % 5, i, j;
+		char h8[256], n8[32];
+		uint16_t h16[128], n16[16];
+		unsigned h8l = 0, n8l = 0, h16l = 0, n16l = 0;
+		long expect = -1, r8, r16;
+		size_t m8, m16;
+		ucase_needle *nd;
+		for (i = 0; i < hl; i++)
+			hay[i] = abc[rand() % n];
+		for (i = 0; i < nl; i++)
+			ndl[i] = abc[rand() % n];
+		if (hl >= nl && rand() % 2) {
+			unsigned at = rand() % (hl - nl + 1);
+			for (i = 0; i < nl; i++)
+				hay[at + i] = abc[rand() % n];
+			for (i = 0; i < nl; i++)
+				ndl[i] = hay[at + i];
+		}
+		for (i = 0; i + nl <= hl && expect < 0; i++) {
+			for (j = 0; j < nl && ucase(hay[i + j]) == ucase(ndl[j]); j++)
+				;
+			if (j == nl)
+				expect = i;
+		}
+		for (i = 0; i < hl; i++) {
+			u8_enc(h8 + h8l, hay[i]);
+			h8l += u8_len(hay[i]);
+			if (hay[i] > 0xFFFF) {
+				h16[h16l++] = 0xD800 + ((hay[i] - 0x10000) >> 10);
+				h16[h16l++] = 0xDC00 + ((hay[i] - 0x10000) & 0x3FF);
+			} else {
+				h16[h16l++] = hay[i];
+			}
+		}
+		for (i = 0; i < nl; i++) {
+			u8_enc(n8 + n8l, ndl[i]);
+			n8l += u8_len(ndl[i]);
+			if (ndl[i] > 0xFFFF) {
+				n16[n16l++] = 0xD800 + ((ndl[i] - 0x10000) >> 10);
+				n16[n16l++] = 0xDC00 + ((ndl[i] - 0x10000) & 0x3FF);
+			} else {
+				n16[n16l++] = ndl[i];
+			}
+		}
+		nd = t % 2 ? ucase_needle_u8(n8, n8l) : ucase_needle_u16(n16, n16l);
+		r8 = ucase_find_u8(nd, h8, h8l, &m8);
+		r16 = ucase_find_u16(nd, h16, h16l, &m16);
+		ucase_needle_free(nd);
+		/* Convert expected code point index into byte and unit offsets */
+		if (expect >= 0) {
+			long e8 = 0, e16 = 0;
+			for (i = 0; i < (unsigned)expect; i++) {
+				e8 += u8_len(hay[i]);
+				e16 += hay[i] > 0xFFFF ? 2 : 1;
+			}
+			if (r8 != e8 || r16 != e16) {
+				printf("Error in ucase_find: expected %ld/%ld, got %ld/%ld\n", e8, e16, r8, r16);
+				err++;
+			}
+		} else if (r8 != -1 || r16 != -1) {
+			printf("Error in ucase_find: false match at %ld/%ld\n", r8, r16);
+			err++;
+		}
+	}
+	/* Malformed bytes are found only as themselves: C3 41 is not \u00C1 */
+	for (t = 0; t < sizeof(bad) / sizeof(*bad); t++) {
+		ucase_needle *nd = ucase_needle_u8(bad[t].needle, strlen(bad[t].needle));
+		long r = ucase_find_u8(nd, bad[t].hay, strlen(bad[t].hay), NULL);
+		ucase_needle_free(nd);
+		if (r != bad[t].at) {
+			printf("Error in ucase_find: malformed case %u at %ld, expected %ld\n", t, r, bad[t].at);
+			err++;
+		}
+	}
+	return err;
+}
+
+struct match_sum {
+	unsigned	count;
+	unsigned	sum;
+};
+
+static int
+match_cb(unsigned id, size_t end, void *arg)
+{
+	struct match_sum *ms = (struct match_sum*)arg;
+	ms->count++;
+	ms->sum += (id + 1) * (end + 7);
+	return 0;
+}
+
+/* Compares ucmatch with naive matching of every pattern at every position */
+static unsigned
+test_match(void)
+{
+	static const unsigned abc[] = {'a', 'A', 'k', 'K', 0x212A, 0x044F, 0x042F, 0x10400, 0x10428};
+	unsigned t, err = 0, n = sizeof(abc) / sizeof(*abc);
+	srand(2);
+	for (t = 0; t < 2000; t++) {
+		unsigned pat[16][4], pl[16], np = 1 + rand() % 16, text[128], tl = rand() % 128, i, j, k;
+		struct match_sum got = {0, 0}, expect = {0, 0};
+		ucmatch_builder *b = ucmatch_builder_new();
+		ucmatch *m;
+		char buf[512];
+		unsigned bl = 0, off[129];
+		for (i = 0; i < np; i++) {
+			char p8[16];
+			unsigned p8l = 0;
+			pl[i] = 1 + rand() % 4;
+			for (j = 0; j < pl[i]; j++) {
+				pat[i][j] = abc[rand() % n];
+				u8_enc(p8 + p8l, pat[i][j]);
+				p8l += u8_len(pat[i][j]);
+			}
+			ucmatch_add(b, p8, p8l, i);
+		}
+		m = ucmatch_build(b);
+		for (i = 0; i < tl; i++) {
+			text[i] = abc[rand() % n];
+			u8_enc(buf + bl, text[i]);
+			bl += u8_len(text[i]);
+			off[i + 1] = bl;
+		}
+		for (i = 1; i <= tl; i++) {
+			for (k = 0; k < np; k++) {
+				if (pl[k] > i)
+					continue;
+				for (j = 0; j < pl[k] && ucase(text[i - pl[k] + j]) == ucase(pat[k][j]); j++)
+					;
+				if (j == pl[k])
+					match_cb(k, off[i], &expect);
+			}
+		}
+		ucmatch_scan_u8(m, buf, bl, match_cb, &got);
+		ucmatch_free(m);
+		if (got.count != expect.count || got.sum != expect.sum) {
+			printf("Error in ucmatch: expected %u matches, got %u\n", expect.count, got.count);
+			err++;
+		}
+	}
+	/* Malformed bytes match only themselves: C3 41 is not \u00C1 */
+	{
+		struct match_sum got = {0, 0}, expect = {0, 0};
+		ucmatch_builder *b = ucmatch_builder_new();
+		ucmatch *m;
+		ucmatch_add(b, "\xC3\xA1", 2, 0);
+		ucmatch_add(b, "\xC3", 1, 1);
+		ucmatch_add(b, "\xC3" "a", 2, 2);
+		m = ucmatch_build(b);
+		ucmatch_scan_u8(m, "x\xC3" "Ay", 4, match_cb, &got);
+		ucmatch_free(m);
+		match_cb(1, 2, &expect);
+		match_cb(2, 3, &expect);
+		if (got.count != expect.count || got.sum != expect.sum) {
+			printf("Error in ucmatch: wrong matches in malformed text\n");
+			err++;
+		}
+	}
+	return err;
+}
+
+static int
+count_cb(const unsigned char *key, size_t len, void *value, void *arg)
+{
+	(*(unsigned*)arg)++;
+	return 0;
+}
+
+/* Random keys of tricky characters: every key is found by any of its case forms,
+ * prefix iteration returns the same number of keys as naive check */
+static unsigned
+test_trie(void)
+{
+	static const unsigned abc[] = {'a', 'A', 'b', 'k', 'K', 0x212A, 0x044F, 0x042F, 0x10400, 0x10428};
+	unsigned keys[512][24], kl[512], t, i, j, k, err = 0, n = sizeof(abc) / sizeof(*abc);
+	uctrie *tr = uctrie_new();
+	struct uctrie_stats st;
+	srand(3);
+	for (i = 0; i < 512; i++) {
+		char buf[128];
+		unsigned bl = 0;
+		void *old;
+		/* Long shared prefixes exercise compressed paths */
+		kl[i] = (i % 4 ? 1 : 12) + rand() % 12;
+		for (j = 0; j < kl[i]; j++) {
+			keys[i][j] = j < 10 && i % 4 == 0 ? 'x' : abc[rand() % n];
+			u8_enc(buf + bl, keys[i][j]);
+			bl += u8_len(keys[i][j]);
+		}
+		uctrie_insert(tr, buf, bl, (void*)(uintptr_t)(i + 1), &old);
+	}
+	for (t = 0; t < 512; t++) {
+		char buf[128];
+		unsigned bl = 0, first = 0, expect = 0, got = 0;
+		void *v;
+		/* Lookup by other case form */
+		for (j = 0; j < kl[t]; j++) {
+			unsigned c = keys[t][j];
+			for (k = 0; k < n; k++)
+				if (ucase(abc[k]) == ucase(c) && abc[k] != c)
+					c = abc[k];
+			u8_enc(buf + bl, c);
+			bl += u8_len(c);
+		}
+		v = uctrie_lookup(tr, buf, bl);
+		for (i = 0; i < 512; i++) {
+			if (kl[i] != kl[t])
+				continue;
+			for (j = 0; j < kl[t] && ucase(keys[i][j]) == ucase(keys[t][j]); j++)
+				;
+			if (j == kl[t])
+				first = i + 1;
+		}
+		if ((uintptr_t)v != first) {
+			printf("Error in uctrie_lookup of key %u: got %u\n", t, (unsigned)(uintptr_t)v);
+			err++;
+		}
+		/* Prefix of random length */
+		bl = 0;
+		for (j = 0; j < kl[t] / 2; j++) {
+			u8_enc(buf + bl, keys[t][j]);
+			bl += u8_len(keys[t][j]);
+		}
+		uctrie_prefix(tr, buf, bl, count_cb, &got);
+		for (i = 0; i < 512; i++) {
+			unsigned dup = 0;
+			if (kl[i] < kl[t] / 2)
+				continue;
+			for (j = 0; j < kl[t] / 2 && ucase(keys[i][j]) == ucase(keys[t][j]); j++)
+				;
+			/* Keys equal after folding are stored once */
+			for (k = 0; k < i && j == kl[t] / 2 && !dup; k++) {
+				unsigned m;
+				if (kl[k] != kl[i])
+					continue;
+				for (m = 0; m < kl[i] && ucase(keys[i][m]) == ucase(keys[k][m]); m++)
+					;
+				dup = m == kl[i];
+			}
+			if (j == kl[t] / 2 && !dup)
+				expect++;
+		}
+		if (got != expect) {
+			printf("Error in uctrie_prefix of key %u: expected %u, got %u\n", t, expect, got);
+			err++;
+		}
+	}
+	uctrie_stats(tr, &st);
+	if (st.leaves > 512 || !st.node4) {
+		printf("Error in uctrie_stats: %u leaves\n", (unsigned)st.leaves);
+		err++;
+	}
+	uctrie_free(tr);
+	/* Long key is folded through heap scratch buffer before leaf is allocated */
+	{
+		static char lk[1200], lk2[400];
+		tr = uctrie_new();
+		for (i = 0; i < 400; i++) {
+			u8_enc(lk + i * 3, 0x212A);
+			lk2[i] = 'k';
+		}
+		uctrie_insert(tr, lk, sizeof(lk), (void*)2, NULL);
+		if (uctrie_lookup(tr, lk2, sizeof(lk2)) != (void*)2) {
+			printf("Error in uctrie_lookup of long key\n");
+			err++;
+		}
+		uctrie_free(tr);
+	}
+	/* Malformed key C3 41 is not \u00C1 and does not replace it */
+	{
+		void *old;
+		unsigned got = 0;
+		tr = uctrie_new();
+		uctrie_insert(tr, "\xC3\xA1", 2, (void*)1, NULL);
+		if (uctrie_lookup(tr, "\xC3" "A", 2)) {
+			printf("Error in uctrie_lookup of malformed key\n");
+			err++;
+		}
+		uctrie_insert(tr, "\xC3" "A", 2, (void*)2, &old);
+		uctrie_prefix(tr, "\xC3" "a", 2, count_cb, &got);
+		if (old || got != 1 || uctrie_lookup(tr, "\xC3\x81", 2) != (void*)1 ||
+				uctrie_lookup(tr, "\xC3" "a", 2) != (void*)2) {
+			printf("Error in uctrie_insert of malformed key\n");
+			err++;
+		}
+		uctrie_free(tr);
+	}
+	return err;
+}
+
+/* Column of random strings (some of them pure ASCII, some empty) folded at once
+ * must be the same as strings folded one by one */
+static unsigned
+test_column(void)
+{
+	static const unsigned abc[] = {'a', 'Z', ' ', 'K', 0x212A, 0x017F, 0x023A, 0x042F, 0x0451, 0x10400};
+	static char data[1 << 16], out[UCASE_FOLD_BOUND(1 << 16)], ref[UCASE_FOLD_BOUND(1 << 16)];
+	static int32_t offs[2049], out_offs[2049];
+	unsigned t, i, err = 0, n = sizeof(abc) / sizeof(*abc);
+	srand(4);
+	for (t = 0; t < 50; t++) {
+		unsigned strings = rand() % 2048, len = 0;
+		long r;
+		offs[0] = t;
+		len = t;
+		for (i = 0; i < strings; i++) {
+			unsigned l = rand() % 24, ascii = rand() % 2, j;
+			for (j = 0; j < l; j++) {
+				unsigned c = ascii ? 'A' + rand() % 58 : abc[rand() % n];
+				u8_enc(data + len, c);
+				len += u8_len(c);
+			}
+			offs[i + 1] = len;
+		}
+		r = ucase_fold_column(offs, data, strings, out, sizeof(out), out_offs);
+		for (i = 0; i < strings; i++) {
+			unsigned rl = u8f_fold_str(data + offs[i], offs[i + 1] - offs[i], ref);
+			if (out_offs[i + 1] - out_offs[i] != (int32_t)rl || memcmp(out + out_offs[i], ref, rl)) {
+				printf("Error in ucase_fold_column: string %u of column %u\n", i, t);
+				err++;
+				break;
+			}
+		}
+		if (out_offs[0] != 0 || r != out_offs[strings]) {
+			printf("Error in ucase_fold_column: column %u length %ld\n", t, r);
+			err++;
+		}
+	}
+	/* Truncated sequences at string ends must not swallow the next string,
+	 * malformed bytes anywhere (overlongs and surrogates too) are copied as is */
+	{
+		static const char col[] = "\xC3" "ABC" "\xC3\x84x" "\xE2\x84" "K\xD0\x41Z\xF0\x90\x90" "\x80\xC0\xAF\xFF\xD0\x90"
+			"\xE0\x81\x81\xED\xA0\x80\xF4\x90\x80\x80" "A";
+		static const char exp[] = "\xC3" "abc" "\xC3\xA4x" "\xE2\x84" "k\xD0\x61z\xF0\x90\x90" "\x80\xC0\xAF\xFF\xD0\xB0"
+			"\xE0\x81\x81\xED\xA0\x80\xF4\x90\x80\x80" "a";
+		static const int32_t co[] = {0, 1, 4, 7, 9, 16, 22, 33};
+		long r = ucase_fold_column(co, col, 7, out, sizeof(out), out_offs);
+		if (r != sizeof(exp) - 1 || memcmp(out, exp, r) || memcmp(out_offs, co, sizeof(co))) {
+			printf("Error in ucase_fold_column: malformed column\n");
+			err++;
+		}
+	}
+	return err;
+}
+
+/* Every code point (and some garbage above 0x10FFFF) folded in place, starting
+ * at odd offset so that vector and scalar tails both get exercised */
+static unsigned
+test_u32(void)
+{
+	static uint32_t buf[0x110000 + 16];
+	unsigned i, n = 0x110000 + 7, err = 0;
+	for (i = 0; i < n; i++)
+		buf[i + 1] = i < 0x110000 ? i : 0xFFFFFFF0u + i - 0x110000;
+	ucase_fold_u32(buf + 1, buf + 1, n);
+	for (i = 0; i < n; i++) {
+		uint32_t c = i < 0x110000 ? i : 0xFFFFFFF0u + i - 0x110000;
+		uint32_t f = i < 0x110000 ? ucase(c) : c;
+		if (buf[i + 1] != f) {
+			printf("Error in ucase_fold_u32: %04X -> %04X (%04X)\n", c, buf[i + 1], f);
+			if (++err > 10)
+				break;
+		}
+	}
+	return err;
+}
+
+/* Stateful folding: every code point in order and in jumpy order (cursor is
+ * reloaded on almost every character), then random UTF-8 strings */
+static unsigned
+test_run(void)
+{
+	static const unsigned abc[] = {'a', 'Z', ' ', 'K', 0x212A, 0x017F, 0x023A, 0x042F, 0x0451, 0x10400, 0x1E9E, 0xFF21};
+	static uint32_t buf[0x110000];
+	static char data[4096], out[UCASE_FOLD_BOUND(4096)], ref[UCASE_FOLD_BOUND(4096)];
+	unsigned i, t, pass, err = 0, n = sizeof(abc) / sizeof(*abc);
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < 0x110000; i++)
+			buf[i] = pass ? (i * 40503u) % 0x110000 : i;
+		ucase_fold_u32_run(buf, buf, 0x110000);
+		for (i = 0; i < 0x110000; i++) {
+			uint32_t c = pass ? (i * 40503u) % 0x110000 : i;
+			if (buf[i] != ucase(c)) {
+				printf("Error in ucase_fold_u32_run: %04X -> %04X (%04X)\n", c, buf[i], ucase(c));
+				if (++err > 10)
+					return err;
+			}
+		}
+	}
+	srand(5);
+	for (t = 0; t < 1000; t++) {
+		unsigned len = 0, l = rand() % 1024, rl;
+		long r;
+		for (i = 0; i < l; i++) {
+			unsigned c = rand() % 3 ? abc[rand() % n] : 'A' + rand() % 58;
+			u8_enc(data + len, c);
+			len += u8_len(c);
+		}
+		r = ucase_fold_u8_run(data, len, out, sizeof(out));
+		rl = u8f_fold_str(data, len, ref);
+		if (r != (long)rl || memcmp(out, ref, rl)) {
+			printf("Error in ucase_fold_u8_run: string %u\n", t);
+			err++;
+		}
+	}
+	return err;
+}
+
+/* Random mix of ASCII runs, valid characters and broken sequences. Reference for
+ * U+FFFD replacement is ICU conversion (same maximal subparts) folded by ucase();
+ * failure must be reported iff ICU substituted anything, and passing bytes
+ * through must keep the same subparts invalid. */
+static unsigned
+test_u8_valid(void)
+{
+	static const char *junk[] = {"\x80", "\xBF", "\xC0\xAF", "\xC1\xBF", "\xF5\x80", "\xFF",
+		"\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xF0\x80\x80\xAF",
+		"\xE2\x82", "\xF0\x90\x90", "\xC3", "\xE2\x28\xA1"};
+	static const unsigned abc[] = {'a', 'Z', 'K', 0x212A, 0x017F, 0x023A, 0x042F, 0x0451, 0x10400, 0x1E9E, 0xFF21, 0xFFFD};
+	static char data[512], out[UCASE_FOLD_U8_BOUND(512)], ref[UCASE_FOLD_U8_BOUND(512)], pass[UCASE_FOLD_U8_BOUND(512)];
+	static UChar u16[512];
+	unsigned t, err = 0;
+	srand(6);
+	for (t = 0; t < 20000; t++) {
+		unsigned len = 0, rl = 0, i, broken = rand() % 2;
+		int32_t ul = 0, subs = 0;
+		UErrorCode e = U_ZERO_ERROR;
+		long r;
+		size_t bad = ~(size_t)0;
+		while (len < 400) {
+			unsigned k = rand() % 16;
+			if (k < 6) {
+				for (i = rand() % 40; i && len < 400; i--)
+					data[len++] = 'A' + rand() % 58;
+			} else if (k < 15 || !broken) {
+				unsigned c = abc[rand() % (sizeof(abc) / sizeof(*abc))];
+				u8_enc(data + len, c);
+				len += u8_len(c);
+			} else {
+				const char *j = junk[rand() % (sizeof(junk) / sizeof(*junk))];
+				memcpy(data + len, j, strlen(j));
+				len += strlen(j);
+			}
+		}
+		len -= rand() % 3;	/* may cut the last character */
+		u_strFromUTF8WithSub(u16, 512, &ul, data, len, 0xFFFD, &subs, &e);
+		for (i = 0; i < (unsigned)ul; ) {
+			UChar32 c;
+			U16_NEXT(u16, i, ul, c);
+			u8_enc(ref + rl, ucase(c));
+			rl += u8_len(ucase(c));
+		}
+		r = ucase_fold_u8(data, len, out, sizeof(out), UCASE_U8_REPLACE, NULL);
+		if (U_FAILURE(e) || r != (long)rl || memcmp(out, ref, rl)) {
+			printf("Error in ucase_fold_u8: string %u replaced\n", t);
+			err++;
+		}
+		r = ucase_fold_u8(data, len, out, sizeof(out), UCASE_U8_FAIL, &bad);
+		if ((r == -2) != (subs != 0) || (r == -2 && (bad >= len ||
+				ucase_fold_u8(data, bad, out, sizeof(out), UCASE_U8_FAIL, NULL) < 0))) {
+			printf("Error in ucase_fold_u8: string %u failed at %zu\n", t, bad);
+			err++;
+		}
+		r = ucase_fold_u8(data, len, pass, sizeof(pass), UCASE_U8_PASS, NULL);
+		if (r < 0 || ucase_fold_u8(pass, r, out, sizeof(out), UCASE_U8_REPLACE, NULL) != (long)rl ||
+				memcmp(out, ref, rl)) {
+			printf("Error in ucase_fold_u8: string %u passed through\n", t);
+			err++;
+		}
+	}
+	return err;
+}
+
+/* Class of every code point must be exactly the code points with the same fold */
+static unsigned
+test_closure(void)
+{
+	static unsigned char cnt[0x110000];
+	unsigned c, i, n, err = 0, out[UCC_MAX];
+	for (c = 0; c < 0x110000; c++)
+		cnt[ucase(c)]++;
+	for (c = 0; c < 0x110000; c++) {
+		unsigned f = ucase(c), self = 0;
+		n = ucc_closure(c, out);
+		for (i = 0; i < n; i++) {
+			self |= out[i] == c;
+			if (ucase(out[i]) != f)
+				break;
+		}
+		if (n != cnt[f] || out[0] != f || i != n || !self) {
+			printf("Error in ucc_closure: U+%04X has %u forms (%u)\n", c, n, cnt[f]);
+			if (++err > 10)
+				break;
+		}
+	}
+	return err;
+}
+
+/* reset/CaseFolding.txt maps odd to even in 0101..012F and even to odd in
+ * 0200..022E, headers must use "c & ~1" and "c | 1" for them (see Makefile) */
+static unsigned
+test_reset(void)
+{
+	unsigned c, my, err = 0;
+	for (c = 0; c < 0x400; c++) {
+		my = c >= 0x101 && c <= 0x12F ? c & ~1 : c >= 0x200 && c <= 0x22E ? c | 1 : c;
+		if (ucr_fold(c) != my || ucro_fold(c) != my) {
+			printf("Error in reset symbol U+%04X:\n"
+					"  my:  U+%04X\n"
+					"  -l:  U+%04X\n"
+					"  -O:  U+%04X\n", c, my, ucr_fold(c), ucro_fold(c));
+			err++;
+		}
+	}
+	return err;
+}
+
+/* Every code point passed through instrumented ucase() once: each one ends in
+ * exactly one leaf and every interval is hit by all of its characters */
+static unsigned
+test_prof(void)
+{
+	const struct ucase_prof_slot *s;
+	unsigned long total = 0;
+	unsigned i, n, err = 0;
+	ucase_prof_reset();
+	for (i = 0; i < 0x110000; i++)
+		ucase(i);
+	s = ucase_prof_slots_get(&n);
+	for (i = 0; i < n; i++) {
+		if (s[i].kind == UCASE_PROF_NODE)
+			continue;
+		total += ucase_prof_hits[i];
+		if ((s[i].kind == UCASE_PROF_HIT || s[i].kind == UCASE_PROF_PRIO) &&
+				ucase_prof_hits[i] != s[i].last - s[i].first + 1) {
+			printf("Error in profile: %04X-%04X hit %lu times\n", s[i].first, s[i].last, ucase_prof_hits[i]);
+			err++;
+		}
+	}
+	if (total != 0x110000) {
+		printf("Error in profile: %lu leaves hit\n", total);
+		err++;
+	}
+	return err;
+}
+
 int main(int argc, char **argv)
 {
 	unsigned i, err = 0;
 	unsigned st[10];
+	ucblob *blob = ucblob_open("/tmp/ucase.bin");
+	if (!blob) {
+		perror("/tmp/ucase.bin");
+		return 1;
+	}
 	memset(st, 0, sizeof(st));
 	for (i = 0; i < 0x1FFFFF; i++) {
 #if 1
 		cmp = 0;
-		char u8[4];
+		char u8[4], fsm[4];
 		unsigned my = ucase(i);
 		unsigned icu = u_foldCase(i, U_FOLD_CASE_DEFAULT);
-		unsigned u8f;
+		unsigned u8f, fsmf;
+		const unsigned char *fsm_src = (const unsigned char*)u8;
+		unsigned char *fsm_dst = (unsigned char*)fsm;
 		u8_enc(u8, i);
 		u8f = utf8_casefold_char(u8);
+		u8f_fold_char(&fsm_src, &fsm_dst);
+		fsmf = u8_dec(fsm);
 		if (my != icu) {
 			printf("Error in symbol U+%04X:\n"
 					"  my:  U+%04X\n"
@@ -125,11 +746,65 @@ int main(int argc, char **argv)
 					"  my:  U+%04X\n"
 					"  icu: U+%04X\n", i, u8f, icu);
 		}
+		if (i <= 0xFFFF && ucase_bmp(i) != my) {
+			printf("Error in BMP-only symbol U+%04X:\n"
+					"  my:  U+%04X\n"
+					"  bmp: U+%04X\n", i, my, ucase_bmp(i));
+			err++;
+		}
+		if (uci_fold(i) != my) {
+			printf("Error in inline symbol U+%04X:\n"
+					"  my:     U+%04X\n"
+					"  inline: U+%04X\n", i, my, uci_fold(i));
+			err++;
+		}
+		if (ucbf_fold(i) != my) {
+			printf("Error in branch-free symbol U+%04X:\n"
+					"  my:   U+%04X\n"
+					"  cmov: U+%04X\n", i, my, ucbf_fold(i));
+			err++;
+		}
+		if (ucblob_fold(blob, i) != my) {
+			printf("Error in blob symbol U+%04X:\n"
+					"  my:   U+%04X\n"
+					"  blob: U+%04X\n", i, my, ucblob_fold(blob, i));
+			err++;
+		}
+#ifdef HAVE_CASEMAP
+		if (ucase_toupper(i) != u_toupper(i) || ucase_tolower(i) != u_tolower(i) ||
+				ucase_totitle(i) != u_totitle(i) || ucase_toupper_flat(i) != ucase_toupper(i) ||
+				ucase_tolower_flat(i) != ucase_tolower(i)) {
+			printf("Error in case mapping of symbol U+%04X:\n"
+					"  upper: U+%04X, icu: U+%04X\n"
+					"  lower: U+%04X, icu: U+%04X\n"
+					"  title: U+%04X, icu: U+%04X\n", i,
+					ucase_toupper(i), u_toupper(i), ucase_tolower(i), u_tolower(i),
+					ucase_totitle(i), u_totitle(i));
+			err++;
+		}
+#endif
+		if (fsmf != my) {
+			printf("Error in UTF-8 automaton symbol U+%04X:\n"
+					"  my:  U+%04X\n"
+					"  fsm: U+%04X\n", i, my, fsmf);
+			err++;
+		}
 #else
 //		err += u_foldCase(i, U_FOLD_CASE_DEFAULT); //ucase(i);
 		err += ucase(i);
 #endif
 	}
+	ucblob_close(blob);
+	err += test_find();
+	err += test_match();
+	err += test_trie();
+	err += test_column();
+	err += test_u32();
+	err += test_run();
+	err += test_closure();
+	err += test_reset();
+	err += test_u8_valid();
+	err += test_prof();
 	if (err)
 		printf("Total %u errors detected\n", err);
 	else
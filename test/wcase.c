@@ -0,0 +1,130 @@
+/*
+ * Microbenchmark for ucwchar.c: run as is and as LD_PRELOAD=./libucwchar.so ./wcase.
+ * Functions called directly are interposed by the shim, glibc versions are
+ * looked up in libc.so.6 itself, so both run in the same process.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <locale.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+#define WORD	16
+
+static unsigned
+clock_diff(const struct timespec *start, const struct timespec *stop)
+{
+	return (stop->tv_sec - start->tv_sec) * 1000000 + (stop->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* UTF-16 units of /tmp/in.dat (surrogates dropped) cut into NUL terminated words */
+static wchar_t *
+read_words(unsigned *n)
+{
+	FILE *f = fopen("/tmp/in.dat", "rb");
+	uint16_t u;
+	wchar_t *w;
+	unsigned len = 0;
+	struct stat st;
+	if (!f || fstat(fileno(f), &st))
+		return NULL;
+	w = malloc((st.st_size / 2 + st.st_size / 2 / WORD + 1) * sizeof(*w));
+	if (!w) {
+		fclose(f);
+		return NULL;
+	}
+	while (fread(&u, 2, 1, f) == 1) {
+		if (u >= 0xD800 && u <= 0xDFFF)
+			continue;
+		if (u && (len + 1) % (WORD + 1))
+			w[len++] = u;
+		else
+			w[len++] = 0;
+	}
+	w[len++] = 0;
+	fclose(f);
+	*n = len;
+	return w;
+}
+
+static void
+bench_map(const char *name, const wchar_t *w, unsigned n, wint_t (*glibc)(wint_t), wint_t (*shim)(wint_t))
+{
+	struct timespec t[3];
+	unsigned i, diff = 0;
+	unsigned long s[2] = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, t);
+	for (i = 0; i < n; i++)
+		s[0] += glibc(w[i]);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	for (i = 0; i < n; i++)
+		s[1] += shim(w[i]);
+	clock_gettime(CLOCK_MONOTONIC, t + 2);
+	for (i = 0; i < n; i++)
+		diff += glibc(w[i]) != shim(w[i]);
+	printf("%-12s glibc %7u us, current %7u us, %u of %u differ\n", name,
+			clock_diff(t, t + 1), clock_diff(t + 1, t + 2), diff, n);
+}
+
+static void
+bench_cmp(const wchar_t *w, const wchar_t *up, unsigned n, int (*glibc)(const wchar_t*, const wchar_t*))
+{
+	struct timespec t[3];
+	unsigned i, eq[2] = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, t);
+	for (i = 0; i + WORD < n; i += WORD + 1)
+		eq[0] += !glibc(w + i, up + i);
+	clock_gettime(CLOCK_MONOTONIC, t + 1);
+	for (i = 0; i + WORD < n; i += WORD + 1)
+		eq[1] += !wcscasecmp(w + i, up + i);
+	clock_gettime(CLOCK_MONOTONIC, t + 2);
+	printf("%-12s glibc %7u us, current %7u us, %u and %u words equal\n", "wcscasecmp",
+			clock_diff(t, t + 1), clock_diff(t + 1, t + 2), eq[0], eq[1]);
+}
+
+int main(int argc, char **argv)
+{
+	void *libc = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+	wint_t (*lower)(wint_t), (*upper)(wint_t);
+	int (*cmp)(const wchar_t*, const wchar_t*);
+	void *cur;
+	Dl_info info;
+	wchar_t *w, *up;
+	unsigned i, n;
+	if (!setlocale(LC_ALL, argc > 1 ? argv[1] : "C.UTF-8"))
+		printf("Locale is not available, using C\n");
+	w = read_words(&n);
+	if (!w || !libc) {
+		printf("Can't open in.dat or libc.so.6\n");
+		return 1;
+	}
+	lower = (wint_t (*)(wint_t))dlsym(libc, "towlower");
+	upper = (wint_t (*)(wint_t))dlsym(libc, "towupper");
+	cmp = (int (*)(const wchar_t*, const wchar_t*))dlsym(libc, "wcscasecmp");
+	up = malloc(n * sizeof(*up));
+	if (!up) {
+		printf("Out of memory\n");
+		free(w);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		up[i] = upper(w[i]);
+	/* towlower is not replaced without HAVE_CASEMAP, wcscasecmp always is */
+	cur = dlsym(RTLD_DEFAULT, "wcscasecmp");
+	if (cur != (void*)cmp && dladdr(cur, &info) && info.dli_fname)
+		printf("shim preloaded from %s\n", info.dli_fname);
+	else
+		printf("glibc (no shim preloaded)\n");
+	bench_map("towlower", w, n, lower, towlower);
+	bench_map("towupper", w, n, upper, towupper);
+	bench_cmp(w, up, n, cmp);
+	free(w);
+	free(up);
+	return 0;
+}
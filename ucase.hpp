@@ -0,0 +1,165 @@
+/*
+ * C++17 wrapper around simple case folding generated by "cf -k FILE".
+ *
+ * Everything here is constexpr, so the same code folds string literals at
+ * compile time (keyword tables, switch on folded hash) and runtime input.
+ */
+#ifndef UCASE_HPP
+#define UCASE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#ifndef UCASE_FOLD_HPP
+# define UCASE_FOLD_HPP "/tmp/ucase_fold.hpp"
+#endif
+#include UCASE_FOLD_HPP
+
+namespace ucase {
+
+/* Malformed byte b is decoded as u8_raw + b: it is never folded, never equal to
+ * any character and u8_encode() writes it back as the same single byte */
+constexpr char32_t u8_raw = 0x110000;
+
+/* Decodes UTF-8 sequence at s[i] into c and returns its length. Each byte of
+ * malformed or truncated sequence (bad continuation, overlong, surrogate, above
+ * U+10FFFF) is decoded on its own as u8_raw + byte. */
+constexpr std::size_t
+u8_decode(std::string_view s, std::size_t i, char32_t &c) noexcept
+{
+	unsigned char b = s[i], lo = 0x80, hi = 0xBF;
+	std::size_t n = s.size() - i, len = 0;
+	if (b < 0x80) {
+		c = b;
+		return 1;
+	}
+	c = u8_raw + b;
+	if (b < 0xC2 || b > 0xF4)
+		return 1;
+	len = b < 0xE0 ? 2 : b < 0xF0 ? 3 : 4;
+	if (n < len)
+		return 1;
+	/* Overlongs, surrogates and values above U+10FFFF are excluded by the range
+	 * of the second byte */
+	if (b == 0xE0)
+		lo = 0xA0;
+	else if (b == 0xED)
+		hi = 0x9F;
+	else if (b == 0xF0)
+		lo = 0x90;
+	else if (b == 0xF4)
+		hi = 0x8F;
+	char32_t v = b & (0x7F >> len);
+	for (std::size_t k = 1; k < len; k++) {
+		unsigned char x = s[i + k];
+		if (x < lo || x > hi)
+			return 1;
+		v = (v << 6) | (x & 0x3F);
+		lo = 0x80;
+		hi = 0xBF;
+	}
+	c = v;
+	return len;
+}
+
+/* Encodes c into dst (at least 4 bytes) and returns number of bytes written,
+ * u8_raw + byte from u8_decode() is written as that byte */
+constexpr std::size_t
+u8_encode(char *dst, char32_t c) noexcept
+{
+	if (c <= 0x7F) {
+		dst[0] = c;
+		return 1;
+	} else if (c >= u8_raw) {
+		dst[0] = c - u8_raw;
+		return 1;
+	} else if (c <= 0x7FF) {
+		dst[0] = 0xC0 | (c >> 6);
+		dst[1] = 0x80 | (c & 0x3F);
+		return 2;
+	} else if (c <= 0xFFFF) {
+		dst[0] = 0xE0 | (c >> 12);
+		dst[1] = 0x80 | ((c >> 6) & 0x3F);
+		dst[2] = 0x80 | (c & 0x3F);
+		return 3;
+	}
+	dst[0] = 0xF0 | (c >> 18);
+	dst[1] = 0x80 | ((c >> 12) & 0x3F);
+	dst[2] = 0x80 | ((c >> 6) & 0x3F);
+	dst[3] = 0x80 | (c & 0x3F);
+	return 4;
+}
+
+/* Folds decoded value, malformed bytes stay as they are */
+constexpr char32_t
+u8_fold(char32_t c) noexcept
+{
+	return c < u8_raw ? fold(c) : c;
+}
+
+/* Fixed capacity string returned by fold_literal() */
+template <std::size_t N>
+struct folded_string {
+	char data[N] = {};
+	std::size_t size = 0;
+
+	constexpr std::string_view view() const noexcept {
+		return std::string_view(data, size);
+	}
+	constexpr operator std::string_view() const noexcept {
+		return view();
+	}
+};
+
+/* Simple folding may turn 2-byte sequence into 3-byte one, but never more, and
+ * malformed bytes are copied one for one, so N + N / 2 bytes are always enough. */
+template <std::size_t N>
+constexpr folded_string<N + N / 2>
+fold_literal(const char (&s)[N]) noexcept
+{
+	folded_string<N + N / 2> r;
+	std::string_view v(s, N - 1);
+	for (std::size_t i = 0; i < v.size(); ) {
+		char32_t c = 0;
+		i += u8_decode(v, i, c);
+		r.size += u8_encode(r.data + r.size, u8_fold(c));
+	}
+	return r;
+}
+
+/* FNV-1a hash of folded UTF-8 representation of s */
+constexpr std::uint32_t
+fold_hash(std::string_view s) noexcept
+{
+	std::uint32_t h = 2166136261u;
+	for (std::size_t i = 0; i < s.size(); ) {
+		char32_t c = 0;
+		char buf[4] = {};
+		std::size_t n = 0;
+		i += u8_decode(s, i, c);
+		n = u8_encode(buf, u8_fold(c));
+		for (std::size_t j = 0; j < n; j++)
+			h = (h ^ (unsigned char)buf[j]) * 16777619u;
+	}
+	return h;
+}
+
+/* Case insensitive equality of two UTF-8 strings */
+constexpr bool
+fold_equal(std::string_view a, std::string_view b) noexcept
+{
+	std::size_t i = 0, j = 0;
+	while (i < a.size() && j < b.size()) {
+		char32_t ca = 0, cb = 0;
+		i += u8_decode(a, i, ca);
+		j += u8_decode(b, j, cb);
+		if (u8_fold(ca) != u8_fold(cb))
+			return false;
+	}
+	return i == a.size() && j == b.size();
+}
+
+} /* namespace ucase */
+
+#endif /* UCASE_HPP */
@@ -0,0 +1,52 @@
+#include "ucbatch.h"
+#include "ucutf8.h"
+#include "/tmp/u8f.h"
+
+long
+ucase_fold_column(const int32_t *offsets, const char *data, size_t n,
+		char *out, size_t out_cap, int32_t *out_offsets)
+{
+	const unsigned char *src = (const unsigned char*)data + offsets[0];
+	const unsigned char *end = (const unsigned char*)data + offsets[n];
+	unsigned char *dst = (unsigned char*)out;
+	int32_t base = offsets[0];
+	long delta = 0;	/* output length minus input length so far */
+	size_t i = 0;
+	if (out_cap < UCASE_FOLD_BOUND((size_t)(end - src)))
+		return -1;
+	while (src < end) {
+		const unsigned char *next;	/* end of current string */
+		/* Strings that begin before current position: their start is not
+		 * affected by the rest of the column */
+		while (i < n && data + offsets[i] <= (const char*)src) {
+			out_offsets[i] = offsets[i] - base + delta;
+			i++;
+		}
+		next = i < n ? (const unsigned char*)data + offsets[i] : end;
+#ifdef __SSE2__
+		/* ASCII is folded 16 bytes at once regardless of string boundaries */
+		if (end - src >= 16 && u8_fold_ascii16(_mm_loadu_si128((const __m128i*)src), dst)) {
+			src += 16;
+			dst += 16;
+			continue;
+		}
+#endif
+		if (*src < 0x80) {
+			*dst++ = u8f_ascii[*src++];
+		} else {
+			const unsigned char *s = src;
+			unsigned char *d = dst;
+			/* Sequence may not continue into the next string */
+			if (u8_check(src, next) < 0) {
+				/* Malformed byte is copied as is, the automaton needs well formed input */
+				*dst++ = *src++;
+				continue;
+			}
+			u8f_fold_char(&src, &dst);
+			delta += (dst - d) - (src - s);
+		}
+	}
+	for (; i <= n; i++)
+		out_offsets[i] = offsets[i] - base + delta;
+	return dst - (unsigned char*)out;
+}
@@ -0,0 +1,31 @@
+/*
+ * Folding of whole string columns in one call.
+ *
+ * Column is given the way Arrow keeps string arrays: string i occupies
+ * data[offsets[i], offsets[i + 1]). Folded column goes into single arena
+ * with its own offsets, so there is no per-string call or allocation.
+ */
+#ifndef __UCBATCH_H
+#define __UCBATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Arena size that is always enough for column of "len" data bytes */
+#define UCASE_FOLD_BOUND(len)	((len) + (len) / 2)
+
+/* Folds n UTF-8 strings into out, out_offsets receives n + 1 offsets (starting
+ * from 0) of folded strings. Returns number of bytes written or -1 if out_cap
+ * is less than UCASE_FOLD_BOUND(offsets[n] - offsets[0]). */
+long ucase_fold_column(const int32_t *offsets, const char *data, size_t n,
+		char *out, size_t out_cap, int32_t *out_offsets);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCBATCH_H */
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ucblob.h"
+
+struct ucblob {
+	const void					*map;
+	size_t						size;
+	const struct ucblob_hdr		*hdr;
+	const struct ucblob_node	*nodes;
+	const uint32_t				*data;
+	unsigned					count;
+};
+
+static int
+ucblob_valid(const struct ucblob_hdr *h, size_t size)
+{
+	const struct ucblob_node *n;
+	unsigned i;
+	if (size < sizeof(*h) || h->magic != UCBLOB_MAGIC || h->version != UCBLOB_VERSION || h->size != size)
+		return 0;
+	if (h->nodes > size || h->count > (size - h->nodes) / sizeof(struct ucblob_node))
+		return 0;
+	if (h->data > size || h->data_len > (size - h->data) / sizeof(uint32_t))
+		return 0;
+	if (h->nodes % sizeof(uint32_t) || h->data % sizeof(uint32_t))
+		return 0;
+	n = (const struct ucblob_node*)((const char*)h + h->nodes);
+	for (i = 0; i < h->count; i++) {
+		if (n[i].first > n[i].last || (i && n[i].first <= n[i - 1].last))
+			return 0;
+		if (n[i].tbl_first <= n[i].tbl_last && (n[i].tbl > h->data_len ||
+					n[i].tbl_last - n[i].tbl_first >= h->data_len - n[i].tbl))
+			return 0;
+	}
+	return 1;
+}
+
+ucblob *
+ucblob_open(const char *fname)
+{
+	struct stat st;
+	ucblob *b;
+	void *p;
+	int fd = open(fname, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	if (!ucblob_valid((const struct ucblob_hdr*)p, st.st_size)) {
+		munmap(p, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	b = (ucblob*)malloc(sizeof(*b));
+	if (!b) {
+		munmap(p, st.st_size);
+		return NULL;
+	}
+	b->map = p;
+	b->size = st.st_size;
+	b->hdr = (const struct ucblob_hdr*)p;
+	b->nodes = (const struct ucblob_node*)((const char*)p + b->hdr->nodes);
+	b->data = (const uint32_t*)((const char*)p + b->hdr->data);
+	b->count = b->hdr->count;
+	return b;
+}
+
+void
+ucblob_close(ucblob *b)
+{
+	if (b) {
+		munmap((void*)b->map, b->size);
+		free(b);
+	}
+}
+
+unsigned
+ucblob_unicode(const ucblob *b)
+{
+	return b->hdr->unicode;
+}
+
+unsigned
+ucblob_fold(const ucblob *b, unsigned c)
+{
+	const struct ucblob_node *n;
+	unsigned lo = 0, hi = b->count;
+	/* Find last node with first <= c */
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (b->nodes[mid].first <= c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return c;
+	n = b->nodes + lo - 1;
+	if (c > n->last)
+		return c;
+	if (c >= n->tbl_first && c <= n->tbl_last)
+		return b->data[n->tbl + c - n->tbl_first];
+	switch (n->kind) {
+	case UCBLOB_DELTA:
+		return c + n->arg;
+	case UCBLOB_SET:
+		return c | 1;
+	case UCBLOB_RESET:
+		return c & ~1u;
+	case UCBLOB_SINGLE:
+		return n->arg;
+	}
+	return c;
+}
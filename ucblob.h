@@ -0,0 +1,69 @@
+/*
+ * Binary case folding tables written by "cf -b FILE" and folding through them.
+ *
+ * File is position independent: header is followed by array of intervals sorted
+ * by first code point and by translation data, both addressed by offsets from the
+ * beginning of file. All integers are in host byte order, so blob is expected to
+ * be built on the same architecture it is used on.
+ */
+#ifndef __UCBLOB_H
+#define __UCBLOB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UCBLOB_MAGIC	0x46435521	/* "!UCF" */
+#define UCBLOB_VERSION	1
+
+enum ucblob_kind {
+	UCBLOB_XLAT = 0,	/* value from table only */
+	UCBLOB_DELTA,		/* c + arg */
+	UCBLOB_SET,			/* c | 1 */
+	UCBLOB_RESET,		/* c & ~1 */
+	UCBLOB_SINGLE		/* arg */
+};
+
+struct ucblob_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	unicode;	/* Unicode version as 0xMMmmuu, 0 if unknown */
+	uint32_t	size;		/* whole file size */
+	uint32_t	nodes;		/* offset of node array */
+	uint32_t	count;		/* number of nodes */
+	uint32_t	data;		/* offset of translation data (uint32_t values) */
+	uint32_t	data_len;	/* number of translation data values */
+};
+
+/* Characters in [tbl_first, tbl_last] are taken from data[tbl + c - tbl_first],
+ * the rest of [first, last] are computed according to kind. Nodes without table
+ * have tbl_first > tbl_last. */
+struct ucblob_node {
+	uint32_t	first;
+	uint32_t	last;
+	uint32_t	kind;
+	int32_t		arg;
+	uint32_t	tbl_first;
+	uint32_t	tbl_last;
+	uint32_t	tbl;
+};
+
+typedef struct ucblob ucblob;
+
+/* Maps and validates blob. Returns NULL with errno set on failure
+ * (EINVAL for wrong magic, unsupported version or malformed offsets). */
+ucblob *ucblob_open(const char *fname);
+void ucblob_close(ucblob *b);
+
+/* Unicode version of CaseFolding.txt blob was built from, as 0xMMmmuu */
+unsigned ucblob_unicode(const ucblob *b);
+
+unsigned ucblob_fold(const ucblob *b, unsigned c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCBLOB_H */
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ucfind.h"
+#include "ucutf8.h"
+#include "/tmp/ucc.h"
+
+/* Anchor is needle character searched for by SIMD prefilter, all its case forms
+ * are represented by the last UTF-8 byte (or last UTF-16 unit) of encoding */
+#define MAX_FORMS	4
+
+struct ucase_needle {
+	unsigned		*cp;		/* folded needle */
+	size_t			len;
+	size_t			a8;			/* index of UTF-8 anchor in cp */
+	unsigned		n8;
+	unsigned char	b8[MAX_FORMS];
+	size_t			a16;		/* index of UTF-16 anchor in cp */
+	unsigned		n16;
+	uint16_t		u16[MAX_FORMS];
+};
+
+static unsigned
+ucfind_fold(unsigned c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+/* Fills out with all characters that fold to f (f included), returns their count
+ * or MAX_FORMS + 1 if there are too many of them */
+static unsigned
+case_forms(unsigned f, unsigned *out)
+{
+	unsigned forms[UCC_MAX], n = ucc_closure(f, forms);
+	if (n > MAX_FORMS)
+		return MAX_FORMS + 1;
+	memcpy(out, forms, n * sizeof(*out));
+	return n;
+}
+
+/* How often byte is expected in text, rarer bytes make better anchors */
+static unsigned
+byte_rank(unsigned b)
+{
+	static const char common[] = " etaoinsrhldcumfpgwybvkxjqz\n.,ETAOINSRHLDCUMFPGWYBVKXJQZ0123456789";
+	const char *p;
+	if (b >= 0x80 && b < 0xC0)
+		return 40;
+	if (b >= 0xC0)
+		return 60;
+	p = b ? strchr(common, b) : NULL;
+	if (p)
+		return 255 - (p - common) * 3;
+	return 10;
+}
+
+static void
+add_form(unsigned *n, void *forms, unsigned size, unsigned v)
+{
+	unsigned i;
+	for (i = 0; i < *n; i++) {
+		if (size == 1 ? ((unsigned char*)forms)[i] == v : ((uint16_t*)forms)[i] == v)
+			return;
+	}
+	if (size == 1)
+		((unsigned char*)forms)[(*n)++] = v;
+	else
+		((uint16_t*)forms)[(*n)++] = v;
+}
+
+static void
+choose_anchors(ucase_needle *n)
+{
+	unsigned best8 = ~0u, best16 = ~0u;
+	size_t j;
+	for (j = 0; j < n->len; j++) {
+		unsigned forms[MAX_FORMS + 1], cnt, i, n8 = 0, n16 = 0, r8 = 0, r16 = 0, raw = 0;
+		unsigned char b8[MAX_FORMS];
+		uint16_t u16[MAX_FORMS];
+		cnt = case_forms(n->cp[j], forms);
+		if (cnt > MAX_FORMS)
+			continue;
+		for (i = 0; i < cnt; i++) {
+			unsigned c = forms[i];
+			if (c >= U8_RAW) {
+				/* Malformed byte of UTF-8 needle, never found in UTF-16 */
+				add_form(&n8, b8, 1, c - U8_RAW);
+				raw = 1;
+				continue;
+			}
+			add_form(&n8, b8, 1, c < 0x80 ? c : 0x80 | (c & 0x3F));
+			add_form(&n16, u16, 2, c <= 0xFFFF ? c : 0xDC00 | (c & 0x3FF));
+		}
+		for (i = 0; i < n8; i++)
+			r8 += byte_rank(b8[i]);
+		for (i = 0; i < n16; i++)
+			r16 += u16[i] < 0x80 ? byte_rank(u16[i]) : 40;
+		if (r8 < best8) {
+			best8 = r8;
+			n->a8 = j;
+			n->n8 = n8;
+			memcpy(n->b8, b8, n8);
+		}
+		if (!raw && r16 < best16) {
+			best16 = r16;
+			n->a16 = j;
+			n->n16 = n16;
+			memcpy(n->u16, u16, n16 * sizeof(*u16));
+		}
+	}
+}
+
+static unsigned
+u16_dec(const uint16_t *s, size_t len, unsigned *c)
+{
+	if (s[0] >= 0xD800 && s[0] < 0xDC00 && len >= 2 && s[1] >= 0xDC00 && s[1] < 0xE000) {
+		*c = 0x10000 + ((s[0] - 0xD800) << 10) + (s[1] - 0xDC00);
+		return 2;
+	}
+	*c = s[0];
+	return 1;
+}
+
+static ucase_needle *
+needle_alloc(size_t len)
+{
+	ucase_needle *n = calloc(1, sizeof(*n));
+	if (!n)
+		return NULL;
+	n->cp = malloc((len ? len : 1) * sizeof(*n->cp));
+	if (!n->cp) {
+		free(n);
+		return NULL;
+	}
+	return n;
+}
+
+ucase_needle *
+ucase_needle_u8(const char *s, size_t len)
+{
+	const unsigned char *p = (const unsigned char*)s, *end = p + len;
+	ucase_needle *n = needle_alloc(len);
+	if (!n)
+		return NULL;
+	while (p < end) {
+		unsigned c;
+		p += u8_dec(p, end - p, &c);
+		n->cp[n->len++] = ucfind_fold(c);
+	}
+	choose_anchors(n);
+	return n;
+}
+
+ucase_needle *
+ucase_needle_u16(const uint16_t *s, size_t len)
+{
+	const uint16_t *end = s + len;
+	ucase_needle *n = needle_alloc(len);
+	if (!n)
+		return NULL;
+	while (s < end) {
+		unsigned c;
+		s += u16_dec(s, end - s, &c);
+		n->cp[n->len++] = ucfind_fold(c);
+	}
+	choose_anchors(n);
+	return n;
+}
+
+void
+ucase_needle_free(ucase_needle *n)
+{
+	if (n) {
+		free(n->cp);
+		free(n);
+	}
+}
+
+/* Start of character that contains byte i. Byte that is not a continuation
+ * always starts one, continuations more than 3 bytes away from it can only be
+ * malformed bytes taken alone, so decoding forward from there is in step with
+ * decoding from the start of h. */
+static size_t
+u8_start(const unsigned char *h, size_t len, size_t i)
+{
+	size_t s = i, e;
+	unsigned c;
+	while (s > 0 && i - s < 3 && (h[s] & 0xC0) == 0x80)
+		s--;
+	while ((e = s + u8_dec(h + s, len - s, &c)) <= i)
+		s = e;
+	return s;
+}
+
+/* Checks whether byte at i is the last byte of anchor character
+ * and the needle matches around it, returns match start or -1 */
+static long
+verify_u8(const ucase_needle *n, const unsigned char *h, size_t len, size_t i, size_t *mlen)
+{
+	size_t s = u8_start(h, len, i), p, j;
+	unsigned c;
+	if (s + u8_dec(h + s, len - s, &c) != i + 1 || ucfind_fold(c) != n->cp[n->a8])
+		return -1;
+	for (j = 0; j < n->a8; j++) {
+		if (!s)
+			return -1;
+		s = u8_start(h, len, s - 1);
+	}
+	for (p = s, j = 0; j < n->len; j++) {
+		if (p >= len)
+			return -1;
+		p += u8_dec(h + p, len - p, &c);
+		if (ucfind_fold(c) != n->cp[j])
+			return -1;
+	}
+	if (mlen)
+		*mlen = p - s;
+	return s;
+}
+
+static long
+verify_u16(const ucase_needle *n, const uint16_t *h, size_t len, size_t i, size_t *mlen)
+{
+	size_t s = i, p, j;
+	unsigned c;
+	if (h[i] >= 0xDC00 && h[i] < 0xE000 && i > 0 && h[i - 1] >= 0xD800 && h[i - 1] < 0xDC00)
+		s--;
+	if (s + u16_dec(h + s, len - s, &c) != i + 1 || ucfind_fold(c) != n->cp[n->a16])
+		return -1;
+	for (j = 0; j < n->a16; j++) {
+		if (!s)
+			return -1;
+		s--;
+		if (h[s] >= 0xDC00 && h[s] < 0xE000 && s > 0 && h[s - 1] >= 0xD800 && h[s - 1] < 0xDC00)
+			s--;
+	}
+	for (p = s, j = 0; j < n->len; j++) {
+		if (p >= len)
+			return -1;
+		p += u16_dec(h + p, len - p, &c);
+		if (ucfind_fold(c) != n->cp[j])
+			return -1;
+	}
+	if (mlen)
+		*mlen = p - s;
+	return s;
+}
+
+long
+ucase_find_u8(const ucase_needle *n, const char *hay, size_t len, size_t *mlen)
+{
+	const unsigned char *h = (const unsigned char*)hay;
+	size_t i = 0;
+	unsigned k;
+	long r;
+	if (!n->len) {
+		if (mlen)
+			*mlen = 0;
+		return 0;
+	}
+	if (!n->n8) {
+		/* No usable anchor, every character is a candidate */
+		for (i = 0; i < len; i += k) {
+			unsigned c;
+			k = u8_dec(h + i, len - i, &c);
+			if ((r = verify_u8(n, h, len, i + k - 1, mlen)) >= 0)
+				return r;
+		}
+		return -1;
+	}
+#ifdef __SSE2__
+	{
+		__m128i v0 = _mm_set1_epi8(n->b8[0]);
+		__m128i v1 = _mm_set1_epi8(n->b8[n->n8 > 1 ? 1 : 0]);
+		__m128i v2 = _mm_set1_epi8(n->b8[n->n8 > 2 ? 2 : 0]);
+		__m128i v3 = _mm_set1_epi8(n->b8[n->n8 > 3 ? 3 : 0]);
+		for (; i + 16 <= len; i += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(h + i));
+			unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+						_mm_or_si128(_mm_cmpeq_epi8(x, v0), _mm_cmpeq_epi8(x, v1)),
+						_mm_or_si128(_mm_cmpeq_epi8(x, v2), _mm_cmpeq_epi8(x, v3))));
+			while (mask) {
+				if ((r = verify_u8(n, h, len, i + __builtin_ctz(mask), mlen)) >= 0)
+					return r;
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		for (k = 0; k < n->n8; k++) {
+			if (h[i] == n->b8[k]) {
+				if ((r = verify_u8(n, h, len, i, mlen)) >= 0)
+					return r;
+				break;
+			}
+		}
+	}
+	return -1;
+}
+
+long
+ucase_find_u16(const ucase_needle *n, const uint16_t *h, size_t len, size_t *mlen)
+{
+	size_t i = 0;
+	unsigned k;
+	long r;
+	if (!n->len) {
+		if (mlen)
+			*mlen = 0;
+		return 0;
+	}
+	if (!n->n16) {
+		for (i = 0; i < len; i++) {
+			unsigned c;
+			if ((h[i] < 0xDC00 || h[i] >= 0xE000) &&
+					(r = verify_u16(n, h, len, i + u16_dec(h + i, len - i, &c) - 1, mlen)) >= 0)
+				return r;
+		}
+		return -1;
+	}
+#ifdef __SSE2__
+	{
+		__m128i v0 = _mm_set1_epi16(n->u16[0]);
+		__m128i v1 = _mm_set1_epi16(n->u16[n->n16 > 1 ? 1 : 0]);
+		__m128i v2 = _mm_set1_epi16(n->u16[n->n16 > 2 ? 2 : 0]);
+		__m128i v3 = _mm_set1_epi16(n->u16[n->n16 > 3 ? 3 : 0]);
+		for (; i + 8 <= len; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(h + i));
+			/* Two mask bits per unit, keep the low one */
+			unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+						_mm_or_si128(_mm_cmpeq_epi16(x, v0), _mm_cmpeq_epi16(x, v1)),
+						_mm_or_si128(_mm_cmpeq_epi16(x, v2), _mm_cmpeq_epi16(x, v3)))) & 0x5555;
+			while (mask) {
+				if ((r = verify_u16(n, h, len, i + __builtin_ctz(mask) / 2, mlen)) >= 0)
+					return r;
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		for (k = 0; k < n->n16; k++) {
+			if (h[i] == n->u16[k]) {
+				if ((r = verify_u16(n, h, len, i, mlen)) >= 0)
+					return r;
+				break;
+			}
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,38 @@
+/*
+ * Case insensitive substring search in UTF-8 and UTF-16 text.
+ *
+ * Needle is folded once when compiled, haystack is never folded as a whole:
+ * candidates are found by SIMD scan for one rare needle character in all its
+ * case forms and only then verified character by character with the fold tree.
+ * Bytes of malformed UTF-8 are characters of their own that match only the
+ * same byte, never a letter.
+ */
+#ifndef __UCFIND_H
+#define __UCFIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ucase_needle ucase_needle;
+
+/* Compile needle given in UTF-8 or UTF-16, compiled needle may be used with
+ * both ucase_find_u8() and ucase_find_u16(). Returns NULL on allocation failure. */
+ucase_needle *ucase_needle_u8(const char *s, size_t len);
+ucase_needle *ucase_needle_u16(const uint16_t *s, size_t len);
+void ucase_needle_free(ucase_needle *n);
+
+/* Return offset of the leftmost match in bytes (units for UTF-16) or -1.
+ * Length of matched text may differ from length of the needle (i.e. KELVIN SIGN
+ * matches "k"), it is stored into *mlen if mlen is not NULL. */
+long ucase_find_u8(const ucase_needle *n, const char *hay, size_t len, size_t *mlen);
+long ucase_find_u16(const ucase_needle *n, const uint16_t *hay, size_t len, size_t *mlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCFIND_H */
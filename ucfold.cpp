@@ -0,0 +1,139 @@
+/*
+ * Kernels behind ucase_fold_u16(). This file is meant to be built without
+ * -march: AVX2 kernel is compiled for its own target and the resolver picks
+ * it only when CPU has AVX2.
+ *
+ * Nothing here may be shared with callers built with other flags, so the
+ * backend is local: instantiations of the string loop for it have internal
+ * linkage and supplementary planes go through own copy of the /tmp/x tree
+ * instead of inline ucase::fold().
+ */
+#include <immintrin.h>
+
+#include "ucfold.hpp"
+
+namespace {
+
+unsigned
+fold_tree(unsigned c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+struct two_stage {
+	static char32_t fold(char32_t c) noexcept {
+		if (c > 0xFFFF)
+			return fold_tree(c);
+		return (c + ucg_stage2[ucg_stage1[c >> 8] + (c & 0xFF)]) & 0xFFFF;
+	}
+};
+
+void
+fold_scalar(const char16_t *in, std::size_t n, char16_t *out)
+{
+	ucase::fold<two_stage>(std::u16string_view(in, n), out);
+}
+
+/* Runs of 8 ASCII units are folded at once, the rest goes through the table */
+__attribute__((target("sse2"))) void
+fold_sse2(const char16_t *in, std::size_t n, char16_t *out)
+{
+	std::size_t i = 0;
+	while (i + 8 <= n) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i t = _mm_sub_epi16(x, _mm_set1_epi16('A'));
+		__m128i up = _mm_and_si128(_mm_cmpgt_epi16(_mm_set1_epi16(26), t),
+				_mm_cmpgt_epi16(t, _mm_set1_epi16(-1)));
+		/* Unsigned compare with 0x7F: both sides are biased by 0x8000 */
+		if (_mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(x, _mm_set1_epi16(-0x8000)),
+				_mm_set1_epi16(-0x8000 + 0x7F)))) {
+			/* Non-ASCII: the block and possibly one unit more */
+			i = ucase::detail::fold_until<two_stage>(in, n, i, i + 8, out);
+			continue;
+		}
+		_mm_storeu_si128((__m128i*)(out + i), _mm_add_epi16(x, _mm_and_si128(up, _mm_set1_epi16(0x20))));
+		i += 8;
+	}
+	fold_scalar(in + i, n - i, out + i);
+}
+
+/* 16 units per iteration: BMP deltas are fetched by two gathers as in ucu32.c,
+ * blocks with surrogates fall back to scalar code */
+__attribute__((target("avx2"))) void
+fold_avx2(const char16_t *in, std::size_t n, char16_t *out)
+{
+	const __m256i lo = _mm256_set1_epi32(0xFF);
+	std::size_t i = 0;
+	while (i + 16 <= n) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(in + i));
+		__m256i sur = _mm256_cmpeq_epi16(_mm256_and_si256(x, _mm256_set1_epi16((short)0xF800)),
+				_mm256_set1_epi16((short)0xD800));
+		__m256i h[2];
+		if (!_mm256_testz_si256(sur, sur)) {
+			i = ucase::detail::fold_until<two_stage>(in, n, i, i + 16, out);
+			continue;
+		}
+		for (int j = 0; j < 2; j++) {
+			__m256i v = _mm256_cvtepu16_epi32(j ? _mm256_extracti128_si256(x, 1) : _mm256_castsi256_si128(x));
+			__m256i blk = _mm256_i32gather_epi32(ucg_stage1, _mm256_srli_epi32(v, 8), 4);
+			__m256i act = _mm256_cmpgt_epi32(blk, _mm256_setzero_si256());
+			if (!_mm256_testz_si256(act, act)) {
+				__m256i idx = _mm256_add_epi32(blk, _mm256_and_si256(v, lo));
+				__m256i d = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+						(const int*)ucg_stage2, idx, act, 2);
+				v = _mm256_and_si256(_mm256_add_epi32(v, d), _mm256_set1_epi32(0xFFFF));
+			}
+			h[j] = v;
+		}
+		/* Pack works within 128-bit lanes, quarters are put back in order */
+		_mm256_storeu_si256((__m256i*)(out + i),
+				_mm256_permute4x64_epi64(_mm256_packus_epi32(h[0], h[1]), 0xD8));
+		i += 16;
+	}
+	fold_scalar(in + i, n - i, out + i);
+}
+
+typedef void (*fold_fn)(const char16_t*, std::size_t, char16_t*);
+
+const struct {
+	const char	*name;
+	fold_fn		fn;
+} kernels[] = {
+	{"scalar", fold_scalar},
+	{"sse2", fold_sse2},
+	{"avx2", fold_avx2},
+};
+
+unsigned
+pick_kernel(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return 2;
+	if (__builtin_cpu_supports("sse2"))
+		return 1;
+	return 0;
+}
+
+} /* namespace */
+
+extern "C" {
+
+/* Called by dynamic linker before constructors, so it only looks at CPU */
+static fold_fn
+resolve_fold_u16(void)
+{
+	return kernels[pick_kernel()].fn;
+}
+
+void ucase_fold_u16(const char16_t *in, std::size_t n, char16_t *out)
+	__attribute__((ifunc("resolve_fold_u16")));
+
+const char *
+ucase_fold_u16_kernel(void)
+{
+	return kernels[pick_kernel()].name;
+}
+
+}
@@ -0,0 +1,162 @@
+/*
+ * C++17 folding of UTF-16 strings with backend chosen at compile time or at run time.
+ *
+ * ucase::fold<Backend>(in, out) instantiates string loop for one lookup policy,
+ * so nothing is decided per character. ucase::fold(in, out) without backend
+ * calls kernel picked once at load time by CPU features (ucfold.cpp, ifunc),
+ * which lets programs be built without -march and still use AVX2 where it is.
+ *
+ * Simple folding never moves characters between BMP and supplementary planes,
+ * so folded string has the same number of units. Unpaired surrogates are
+ * copied as is.
+ */
+#ifndef UCFOLD_HPP
+#define UCFOLD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "ucase.hpp"
+#include "/tmp/ucg.h"
+#include "/tmp/ucbf.h"
+
+extern "C" {
+/* Dispatched kernel, in == out is allowed */
+void ucase_fold_u16(const char16_t *in, std::size_t n, char16_t *out);
+/* Name of the kernel picked for this CPU: "avx2", "sse2" or "scalar" */
+const char *ucase_fold_u16_kernel(void);
+}
+
+namespace ucase {
+
+namespace backend {
+
+/* Nested comparisons from "cf -k", see ucase.hpp */
+struct tree {
+	static char32_t fold(char32_t c) noexcept {
+		return ucase::fold(c);
+	}
+};
+
+/* Two-level table of deltas from "cf -g" for BMP, tree for the rest */
+struct two_stage {
+	static char32_t fold(char32_t c) noexcept {
+		if (c > 0xFFFF)
+			return ucase::fold(c);
+		return (c + ucg_stage2[ucg_stage1[c >> 8] + (c & 0xFF)]) & 0xFFFF;
+	}
+};
+
+/* Segments from "cf -B" found by masked binary search, no branches */
+struct branch_free {
+	static char32_t fold(char32_t c) noexcept {
+		return ucbf_fold(c);
+	}
+};
+
+/* The same segments with starts stored in Eytzinger (BFS) order, so the first
+ * levels of every search share a few cache lines */
+struct eytzinger {
+	static constexpr unsigned size = sizeof(ucbf_first) / sizeof(*ucbf_first);
+
+	struct layout {
+		unsigned	first[size + 1];	/* 1-based, first[0] is unused */
+		unsigned short	seg[size + 1];		/* index of segment in ucbf_seg */
+
+		layout() noexcept {
+			unsigned i = 0;
+			fill(i, 1);
+		}
+		void fill(unsigned &i, unsigned k) noexcept {
+			if (k > size)
+				return;
+			fill(i, 2 * k);
+			first[k] = ucbf_first[i];
+			seg[k] = i++;
+			fill(i, 2 * k + 1);
+		}
+	};
+
+	static const layout &get() noexcept {
+		static const layout l;
+		return l;
+	}
+
+	static char32_t fold(char32_t c) noexcept {
+		const layout &l = get();
+		unsigned k = 1, s, m, r;
+		while (k <= size)
+			k = 2 * k + (l.first[k] <= c);
+		/* Drop the trailing right turns: k becomes the first start above c */
+		k >>= __builtin_ffs(~k);
+		s = k ? l.seg[k] - 1 : size - 1;
+		m = -(unsigned)(ucbf_seg[s].tbl != 0);
+		r = ucbf_data[(c - ucbf_first[s] + ucbf_seg[s].tbl - 1) & m];
+		return (((c | ucbf_seg[s].orbit) + ucbf_seg[s].delta) & ~m) | (r & m);
+	}
+};
+
+} /* namespace backend */
+
+namespace detail {
+
+/* Folds from in[i] until position is at least stop, surrogate pair is never
+ * split; returns the position */
+template <class Backend>
+std::size_t
+fold_until(const char16_t *in, std::size_t n, std::size_t i, std::size_t stop, char16_t *out) noexcept
+{
+	while (i < stop) {
+		char32_t c = in[i];
+		if (c < 0x80) {
+			out[i++] = c - u'A' < 26 ? c + 0x20 : c;
+		} else if (c - 0xD800 < 0x400 && i + 1 < n && in[i + 1] - 0xDC00u < 0x400) {
+			c = Backend::fold(0x10000 + ((c - 0xD800) << 10) + (in[i + 1] - 0xDC00));
+			out[i++] = 0xD800 + ((c - 0x10000) >> 10);
+			out[i++] = 0xDC00 + (c & 0x3FF);
+		} else {
+			/* Lone surrogates fold to themselves in every backend */
+			out[i++] = Backend::fold(c);
+		}
+	}
+	return i;
+}
+
+} /* namespace detail */
+
+/* Folds in into out (in.size() units), returns number of units written */
+template <class Backend>
+std::size_t
+fold(std::u16string_view in, char16_t *out) noexcept
+{
+	return detail::fold_until<Backend>(in.data(), in.size(), 0, in.size(), out);
+}
+
+template <class Backend>
+void
+fold(std::u16string_view in, std::u16string &out)
+{
+	out.resize(in.size());
+	fold<Backend>(in, &out[0]);
+}
+
+/* Kernel picked by CPU features at load time */
+inline std::size_t
+fold(std::u16string_view in, char16_t *out) noexcept
+{
+	ucase_fold_u16(in.data(), in.size(), out);
+	return in.size();
+}
+
+inline void
+fold(std::u16string_view in, std::u16string &out)
+{
+	out.resize(in.size());
+	ucase_fold_u16(in.data(), in.size(), &out[0]);
+}
+
+} /* namespace ucase */
+
+#endif /* UCFOLD_HPP */
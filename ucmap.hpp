@@ -0,0 +1,325 @@
+/*
+ * Case insensitive open addressing hash map and set over UTF-8 keys.
+ *
+ * Keys are stored once, as given, and compared with fold_equal(); folded hash
+ * is computed once per key and cached in its slot, so rehashing never folds
+ * again and mismatching slots are mostly rejected without folding. Slots are
+ * probed in groups of 16 with one control byte per slot (7 bits of hash or
+ * empty/deleted mark), matched by SSE2 compare. Lookup takes string_view, so
+ * no key object is constructed to look something up.
+ */
+#ifndef UCMAP_HPP
+#define UCMAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ucase.hpp"
+
+namespace ucase {
+
+namespace detail {
+
+enum : std::int8_t {
+	ctrl_empty = -128,
+	ctrl_deleted = -2
+};
+
+/* Bit i is set for every control byte in group equal to b */
+inline unsigned
+ctrl_match(const std::int8_t *g, std::int8_t b) noexcept
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i*)g);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+#else
+	unsigned m = 0;
+	for (unsigned i = 0; i < 16; i++)
+		m |= (unsigned)(g[i] == b) << i;
+	return m;
+#endif
+}
+
+/* Multiplication carries entropy of FNV-1a only upwards: the top 7 bits are
+ * the best mixed ones and go to control byte, group index is taken from the
+ * low bits after the high half is folded onto them */
+inline std::uint32_t
+ctrl_hash(std::string_view key) noexcept
+{
+	std::uint32_t h = fold_hash(key) * 0x9E3779B1u;
+	return h ^ (h >> 16);
+}
+
+inline std::int8_t
+ctrl_byte(std::uint32_t h) noexcept
+{
+	return h >> 25;
+}
+
+/* Table shared by flat_map and flat_set, V is empty for set */
+template <class K, class V>
+class flat_table {
+public:
+	struct slot {
+		std::uint32_t	hash;
+		K		key;
+		V		value;
+	};
+
+	flat_table() noexcept = default;
+	flat_table(const flat_table &) = delete;
+	flat_table &operator=(const flat_table &) = delete;
+	flat_table(flat_table &&t) noexcept {
+		swap(t);
+	}
+	flat_table &operator=(flat_table &&t) noexcept {
+		swap(t);
+		return *this;
+	}
+	~flat_table() {
+		clear();
+		::operator delete(m_ctrl);
+	}
+
+	void swap(flat_table &t) noexcept {
+		std::swap(m_ctrl, t.m_ctrl);
+		std::swap(m_slots, t.m_slots);
+		std::swap(m_groups, t.m_groups);
+		std::swap(m_size, t.m_size);
+		std::swap(m_used, t.m_used);
+	}
+
+	std::size_t size() const noexcept {
+		return m_size;
+	}
+	bool empty() const noexcept {
+		return !m_size;
+	}
+	std::size_t capacity() const noexcept {
+		return m_groups * 16;
+	}
+
+	slot *find(std::string_view key) const noexcept {
+		return m_groups ? lookup(key, ctrl_hash(key)) : nullptr;
+	}
+
+	/* Returns slot of key and true if it was inserted with value constructed from args */
+	template <class... A>
+	std::pair<slot*, bool> emplace(std::string_view key, A&&... args) {
+		std::uint32_t h = ctrl_hash(key);
+		slot *s = m_groups ? lookup(key, h) : nullptr;
+		std::size_t i;
+		if (s)
+			return {s, false};
+		if ((m_used + 1) * 8 > capacity() * 7)
+			rehash(m_size * 2 > capacity() ? capacity() * 2 : capacity());
+		i = free_slot(h);
+		if (m_ctrl[i] == ctrl_empty)
+			m_used++;
+		s = new(m_slots + i) slot{h, K(key), V(std::forward<A>(args)...)};
+		m_ctrl[i] = ctrl_byte(h);
+		m_size++;
+		return {s, true};
+	}
+
+	bool erase(std::string_view key) noexcept {
+		slot *s = find(key);
+		if (!s)
+			return false;
+		s->~slot();
+		m_ctrl[s - m_slots] = ctrl_deleted;
+		m_size--;
+		return true;
+	}
+
+	void clear() noexcept {
+		for (std::size_t i = 0; i < capacity(); i++) {
+			if (m_ctrl[i] >= 0)
+				m_slots[i].~slot();
+			m_ctrl[i] = ctrl_empty;
+		}
+		m_size = m_used = 0;
+	}
+
+	/* Makes room for n keys without rehashing */
+	void reserve(std::size_t n) {
+		std::size_t cap = 16;
+		while (cap * 7 < n * 8)
+			cap *= 2;
+		if (cap > capacity())
+			rehash(cap);
+	}
+
+	/* Calls f(slot&) for every key in unspecified order */
+	template <class F>
+	void for_each(F f) const {
+		for (std::size_t i = 0; i < capacity(); i++)
+			if (m_ctrl[i] >= 0)
+				f(m_slots[i]);
+	}
+
+private:
+	std::int8_t	*m_ctrl = nullptr;	/* capacity() control bytes followed by slots */
+	slot		*m_slots = nullptr;
+	std::size_t	m_groups = 0;
+	std::size_t	m_size = 0;
+	std::size_t	m_used = 0;		/* live and deleted slots */
+
+	slot *lookup(std::string_view key, std::uint32_t h) const noexcept {
+		std::size_t g = h & (m_groups - 1);
+		for (std::size_t step = 1; ; step++) {
+			const std::int8_t *c = m_ctrl + g * 16;
+			for (unsigned m = ctrl_match(c, ctrl_byte(h)); m; m &= m - 1) {
+				slot *s = m_slots + g * 16 + __builtin_ctz(m);
+				if (s->hash == h && fold_equal(s->key, key))
+					return s;
+			}
+			if (ctrl_match(c, ctrl_empty))
+				return nullptr;
+			/* Triangular steps visit every group of power of 2 table */
+			g = (g + step) & (m_groups - 1);
+		}
+	}
+
+	std::size_t free_slot(std::uint32_t h) const noexcept {
+		std::size_t g = h & (m_groups - 1);
+		for (std::size_t step = 1; ; step++) {
+			const std::int8_t *c = m_ctrl + g * 16;
+			unsigned m = ctrl_match(c, ctrl_empty) | ctrl_match(c, ctrl_deleted);
+			if (m)
+				return g * 16 + __builtin_ctz(m);
+			g = (g + step) & (m_groups - 1);
+		}
+	}
+
+	void rehash(std::size_t cap) {
+		flat_table t;
+		if (cap < 16)
+			cap = 16;
+		t.m_ctrl = (std::int8_t*)::operator new(cap + cap * sizeof(slot));
+		t.m_slots = (slot*)(t.m_ctrl + cap);
+		t.m_groups = cap / 16;
+		std::memset(t.m_ctrl, ctrl_empty, cap);
+		for (std::size_t i = 0; i < capacity(); i++) {
+			if (m_ctrl[i] < 0)
+				continue;
+			/* Cached hash: keys are moved, not folded again */
+			std::size_t j = t.free_slot(m_slots[i].hash);
+			new(t.m_slots + j) slot(std::move(m_slots[i]));
+			t.m_ctrl[j] = ctrl_byte(m_slots[i].hash);
+			m_slots[i].~slot();
+			m_ctrl[i] = ctrl_empty;
+		}
+		t.m_size = t.m_used = m_size;
+		m_size = m_used = 0;
+		swap(t);
+	}
+};
+
+struct empty {};
+
+} /* namespace detail */
+
+/* Map from case insensitive UTF-8 key (stored as K) to V */
+template <class K, class V>
+class flat_map {
+public:
+	using slot = typename detail::flat_table<K, V>::slot;
+
+	V *find(std::string_view key) noexcept {
+		slot *s = m_tbl.find(key);
+		return s ? &s->value : nullptr;
+	}
+	const V *find(std::string_view key) const noexcept {
+		slot *s = m_tbl.find(key);
+		return s ? &s->value : nullptr;
+	}
+	bool contains(std::string_view key) const noexcept {
+		return m_tbl.find(key);
+	}
+	/* Key is stored as spelled the first time */
+	std::pair<V*, bool> insert(std::string_view key, V value) {
+		auto r = m_tbl.emplace(key, std::move(value));
+		return {&r.first->value, r.second};
+	}
+	V &operator[](std::string_view key) {
+		return m_tbl.emplace(key).first->value;
+	}
+	bool erase(std::string_view key) noexcept {
+		return m_tbl.erase(key);
+	}
+	void clear() noexcept {
+		m_tbl.clear();
+	}
+	void reserve(std::size_t n) {
+		m_tbl.reserve(n);
+	}
+	std::size_t size() const noexcept {
+		return m_tbl.size();
+	}
+	bool empty() const noexcept {
+		return m_tbl.empty();
+	}
+	/* Calls f(const K &key, V &value) for every entry */
+	template <class F>
+	void for_each(F f) {
+		m_tbl.for_each([&](slot &s) { f((const K&)s.key, s.value); });
+	}
+
+private:
+	detail::flat_table<K, V> m_tbl;
+};
+
+/* Set of case insensitive UTF-8 keys stored as K */
+template <class K = std::string>
+class flat_set {
+public:
+	using slot = typename detail::flat_table<K, detail::empty>::slot;
+
+	bool contains(std::string_view key) const noexcept {
+		return m_tbl.find(key);
+	}
+	/* Returns stored spelling of key or nullptr */
+	const K *find(std::string_view key) const noexcept {
+		slot *s = m_tbl.find(key);
+		return s ? &s->key : nullptr;
+	}
+	bool insert(std::string_view key) {
+		return m_tbl.emplace(key).second;
+	}
+	bool erase(std::string_view key) noexcept {
+		return m_tbl.erase(key);
+	}
+	void clear() noexcept {
+		m_tbl.clear();
+	}
+	void reserve(std::size_t n) {
+		m_tbl.reserve(n);
+	}
+	std::size_t size() const noexcept {
+		return m_tbl.size();
+	}
+	bool empty() const noexcept {
+		return m_tbl.empty();
+	}
+	/* Calls f(const K &key) for every key */
+	template <class F>
+	void for_each(F f) const {
+		m_tbl.for_each([&](slot &s) { f((const K&)s.key); });
+	}
+
+private:
+	detail::flat_table<K, detail::empty> m_tbl;
+};
+
+} /* namespace ucase */
+
+#endif /* UCMAP_HPP */
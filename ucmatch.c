@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "ucmatch.h"
+#include "ucutf8.h"
+
+/* Classes of code points below are looked up directly, the rest by binary search */
+#define DIRECT_CLASSES	0x800
+/* Edge lists longer than that are searched by bisection */
+#define LINEAR_EDGES	8
+
+struct pattern {
+	size_t		off;
+	unsigned	len;
+	unsigned	id;
+};
+
+struct ucmatch_builder {
+	unsigned		*cp;		/* folded code points of all patterns */
+	size_t			cp_len, cp_size;
+	struct pattern	*pat;
+	size_t			pat_len, pat_size;
+};
+
+/* States are numbered in BFS order, so that hot states close to root are
+ * packed together. Root (state 0) has dense transition table, others keep
+ * sorted edge lists in shared arrays. */
+struct ucmatch {
+	uint16_t	direct[DIRECT_CLASSES];
+	unsigned	*upper;			/* sorted folded code points >= DIRECT_CLASSES */
+	unsigned	nupper;
+	unsigned	upper_base;		/* class of upper[0] */
+	unsigned	nclasses;
+	unsigned	nstates;
+	uint32_t	*root;			/* nclasses + 1 */
+	uint32_t	*edge_first;	/* nstates + 1 */
+	uint16_t	*edge_cls;
+	uint32_t	*edge_next;
+	uint32_t	*fail;
+	uint32_t	*dict;			/* nearest state on fail chain with output, 0 if none */
+	uint32_t	*out_first;		/* nstates + 1 */
+	unsigned	*out;
+	size_t		nedges, nout;
+};
+
+static unsigned
+ucmatch_fold(unsigned c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+static int
+grow(void **p, size_t *size, size_t need, size_t elem)
+{
+	size_t n = *size ? *size : 64;
+	void *np;
+	if (need <= *size)
+		return 0;
+	while (n < need)
+		n *= 2;
+	np = realloc(*p, n * elem);
+	if (!np)
+		return -1;
+	*p = np;
+	*size = n;
+	return 0;
+}
+
+ucmatch_builder *
+ucmatch_builder_new(void)
+{
+	return calloc(1, sizeof(ucmatch_builder));
+}
+
+void
+ucmatch_builder_free(ucmatch_builder *b)
+{
+	if (b) {
+		free(b->cp);
+		free(b->pat);
+		free(b);
+	}
+}
+
+int
+ucmatch_add(ucmatch_builder *b, const char *s, size_t len, unsigned id)
+{
+	const unsigned char *p = (const unsigned char*)s, *end = p + len;
+	struct pattern *pt;
+	if (!len)
+		return 0;
+	if (grow((void**)&b->cp, &b->cp_size, b->cp_len + len, sizeof(*b->cp)) ||
+			grow((void**)&b->pat, &b->pat_size, b->pat_len + 1, sizeof(*b->pat)))
+		return -1;
+	pt = b->pat + b->pat_len++;
+	pt->off = b->cp_len;
+	pt->len = 0;
+	pt->id = id;
+	while (p < end) {
+		unsigned c;
+		p += u8_dec(p, end - p, &c);
+		b->cp[b->cp_len++] = ucmatch_fold(c);
+		pt->len++;
+	}
+	return 0;
+}
+
+static unsigned
+cls(const ucmatch *m, unsigned c)
+{
+	unsigned lo = 0, hi = m->nupper;
+	if (c < DIRECT_CLASSES)
+		return m->direct[c];
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (m->upper[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < m->nupper && m->upper[lo] == c ? m->upper_base + lo : 0;
+}
+
+static uint32_t
+step(const ucmatch *m, uint32_t s, unsigned k)
+{
+	while (s) {
+		uint32_t lo = m->edge_first[s], hi = m->edge_first[s + 1];
+		if (hi - lo <= LINEAR_EDGES) {
+			for (; lo < hi; lo++)
+				if (m->edge_cls[lo] == k)
+					return m->edge_next[lo];
+		} else {
+			while (lo < hi) {
+				uint32_t mid = (lo + hi) / 2;
+				if (m->edge_cls[mid] < k)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if (lo < m->edge_first[s + 1] && m->edge_cls[lo] == k)
+				return m->edge_next[lo];
+		}
+		s = m->fail[s];
+	}
+	return m->root[k];
+}
+
+static int
+cmp_uint(const void *a, const void *b)
+{
+	unsigned l = *(const unsigned*)a, r = *(const unsigned*)b;
+	return l < r ? -1 : l > r;
+}
+
+/* Trie used while building */
+struct bnode {
+	uint32_t	child;		/* first child, 0 if none */
+	uint32_t	sibling;
+	uint32_t	out;		/* head of output list + 1, 0 if none */
+	uint16_t	cls;
+};
+
+struct bout {
+	unsigned	id;
+	uint32_t	next;
+};
+
+static int
+cmp_child(const void *a, const void *b, void *arg)
+{
+	const struct bnode *n = (const struct bnode*)arg;
+	uint16_t l = n[*(const uint32_t*)a].cls, r = n[*(const uint32_t*)b].cls;
+	return l < r ? -1 : l > r;
+}
+
+ucmatch *
+ucmatch_build(ucmatch_builder *b)
+{
+	ucmatch *m = calloc(1, sizeof(*m));
+	unsigned *u = NULL, nu = 0;
+	struct bnode *n = NULL;
+	struct bout *o = NULL;
+	uint32_t *queue = NULL, *newid = NULL, *kids = NULL;
+	size_t nn = 1, nsize = 0, no = 0, osize = 0, i;
+	uint32_t qlen = 1, e = 0;
+	if (!m)
+		goto fail;
+
+	/* Classes: distinct folded code points of all patterns */
+	u = malloc((b->cp_len ? b->cp_len : 1) * sizeof(*u));
+	if (!u)
+		goto fail;
+	memcpy(u, b->cp, b->cp_len * sizeof(*u));
+	qsort(u, b->cp_len, sizeof(*u), cmp_uint);
+	for (i = 0; i < b->cp_len; i++)
+		if (!nu || u[nu - 1] != u[i])
+			u[nu++] = u[i];
+	if (nu >= 0xFFFF) {
+		errno = E2BIG;
+		goto fail;
+	}
+	m->nclasses = nu;
+	for (i = 0; i < nu && u[i] < DIRECT_CLASSES; i++)
+		m->direct[u[i]] = i + 1;
+	m->upper_base = i + 1;
+	m->nupper = nu - i;
+	m->upper = malloc((m->nupper ? m->nupper : 1) * sizeof(*m->upper));
+	if (!m->upper)
+		goto fail;
+	memcpy(m->upper, u + i, m->nupper * sizeof(*m->upper));
+
+	/* Trie */
+	if (grow((void**)&n, &nsize, 1, sizeof(*n)))
+		goto fail;
+	memset(n, 0, sizeof(*n));
+	for (i = 0; i < b->pat_len; i++) {
+		uint32_t s = 0;
+		unsigned j;
+		for (j = 0; j < b->pat[i].len; j++) {
+			uint16_t k = cls(m, b->cp[b->pat[i].off + j]);
+			uint32_t c = n[s].child;
+			while (c && n[c].cls != k)
+				c = n[c].sibling;
+			if (!c) {
+				if (grow((void**)&n, &nsize, nn + 1, sizeof(*n)))
+					goto fail;
+				c = nn++;
+				n[c].child = 0;
+				n[c].out = 0;
+				n[c].cls = k;
+				n[c].sibling = n[s].child;
+				n[s].child = c;
+			}
+			s = c;
+		}
+		if (grow((void**)&o, &osize, no + 1, sizeof(*o)))
+			goto fail;
+		o[no].id = b->pat[i].id;
+		o[no].next = n[s].out;
+		n[s].out = ++no;
+	}
+
+	/* Renumber states in BFS order, children sorted by class */
+	m->nstates = nn;
+	queue = malloc(nn * sizeof(*queue));
+	newid = malloc(nn * sizeof(*newid));
+	kids = malloc(nn * sizeof(*kids));
+	m->edge_first = malloc((nn + 1) * sizeof(*m->edge_first));
+	m->edge_cls = malloc(nn * sizeof(*m->edge_cls));
+	m->edge_next = malloc(nn * sizeof(*m->edge_next));
+	m->fail = calloc(nn, sizeof(*m->fail));
+	m->dict = calloc(nn, sizeof(*m->dict));
+	m->out_first = malloc((nn + 1) * sizeof(*m->out_first));
+	m->out = malloc((no ? no : 1) * sizeof(*m->out));
+	m->root = calloc(nu + 1, sizeof(*m->root));
+	if (!queue || !newid || !kids || !m->edge_first || !m->edge_cls || !m->edge_next ||
+			!m->fail || !m->dict || !m->out_first || !m->out || !m->root)
+		goto fail;
+	queue[0] = 0;
+	newid[0] = 0;
+	for (i = 0; i < qlen; i++) {
+		uint32_t c, nk = 0, j, t;
+		for (c = n[queue[i]].child; c; c = n[c].sibling)
+			kids[nk++] = c;
+		qsort_r(kids, nk, sizeof(*kids), cmp_child, n);
+		m->edge_first[i] = e;
+		m->out_first[i] = m->nout;
+		for (t = n[queue[i]].out; t; t = o[t - 1].next)
+			m->out[m->nout++] = o[t - 1].id;
+		for (j = 0; j < nk; j++) {
+			newid[kids[j]] = qlen;
+			queue[qlen++] = kids[j];
+			m->edge_cls[e] = n[kids[j]].cls;
+			m->edge_next[e++] = newid[kids[j]];
+		}
+	}
+	m->edge_first[nn] = e;
+	m->out_first[nn] = m->nout;
+	m->nedges = e;
+	for (i = m->edge_first[0]; i < m->edge_first[1]; i++)
+		m->root[m->edge_cls[i]] = m->edge_next[i];
+
+	/* Failure and dictionary links, parents come before children in BFS order */
+	for (i = 1; i < nn; i++) {
+		uint32_t j;
+		for (j = m->edge_first[i]; j < m->edge_first[i + 1]; j++) {
+			uint32_t t = m->edge_next[j], f = step(m, m->fail[i], m->edge_cls[j]);
+			m->fail[t] = f;
+			m->dict[t] = m->out_first[f] != m->out_first[f + 1] ? f : m->dict[f];
+		}
+	}
+	/* Children of root keep zero fail and dict links */
+
+	free(u);
+	free(n);
+	free(o);
+	free(queue);
+	free(newid);
+	free(kids);
+	ucmatch_builder_free(b);
+	return m;
+fail:
+	free(u);
+	free(n);
+	free(o);
+	free(queue);
+	free(newid);
+	free(kids);
+	ucmatch_free(m);
+	ucmatch_builder_free(b);
+	return NULL;
+}
+
+void
+ucmatch_free(ucmatch *m)
+{
+	if (m) {
+		free(m->upper);
+		free(m->root);
+		free(m->edge_first);
+		free(m->edge_cls);
+		free(m->edge_next);
+		free(m->fail);
+		free(m->dict);
+		free(m->out_first);
+		free(m->out);
+		free(m);
+	}
+}
+
+size_t
+ucmatch_size(const ucmatch *m)
+{
+	return sizeof(*m) + m->nupper * sizeof(*m->upper) + (m->nclasses + 1) * sizeof(*m->root) +
+		(m->nstates + 1) * (sizeof(*m->edge_first) + sizeof(*m->out_first)) +
+		m->nedges * (sizeof(*m->edge_cls) + sizeof(*m->edge_next)) +
+		m->nstates * (sizeof(*m->fail) + sizeof(*m->dict)) + m->nout * sizeof(*m->out);
+}
+
+int
+ucmatch_scan_u8(const ucmatch *m, const char *text, size_t len, ucmatch_cb cb, void *arg)
+{
+	const unsigned char *p = (const unsigned char*)text, *end = p + len;
+	uint32_t s = 0;
+	while (p < end) {
+		unsigned c, k;
+		uint32_t t;
+		p += u8_dec(p, end - p, &c);
+		k = cls(m, ucmatch_fold(c));
+		if (!k) {
+			s = 0;
+			continue;
+		}
+		s = step(m, s, k);
+		t = m->out_first[s] != m->out_first[s + 1] ? s : m->dict[s];
+		while (t) {
+			uint32_t j;
+			for (j = m->out_first[t]; j < m->out_first[t + 1]; j++)
+				if (cb(m->out[j], p - (const unsigned char*)text, arg))
+					return 1;
+			t = m->dict[t];
+		}
+	}
+	return 0;
+}
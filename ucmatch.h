@@ -0,0 +1,44 @@
+/*
+ * Case insensitive multi-pattern matcher (Aho-Corasick over folded code points).
+ *
+ * Patterns are folded when added and text is folded on the fly while scanning,
+ * so automaton never sees unfolded characters and text is not copied.
+ * Bytes of malformed UTF-8 are characters of their own that match only the
+ * same byte, never a letter.
+ */
+#ifndef __UCMATCH_H
+#define __UCMATCH_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ucmatch_builder ucmatch_builder;
+typedef struct ucmatch ucmatch;
+
+/* Called for every match with id of the pattern and offset of the byte
+ * following the match, non-zero return value stops the scan */
+typedef int (*ucmatch_cb)(unsigned id, size_t end, void *arg);
+
+ucmatch_builder *ucmatch_builder_new(void);
+/* Adds UTF-8 pattern, empty patterns are ignored. Returns 0 or -1 on allocation failure. */
+int ucmatch_add(ucmatch_builder *b, const char *s, size_t len, unsigned id);
+/* Compiles automaton and frees the builder. Returns NULL on allocation failure. */
+ucmatch *ucmatch_build(ucmatch_builder *b);
+void ucmatch_builder_free(ucmatch_builder *b);
+
+void ucmatch_free(ucmatch *m);
+/* Memory used by automaton in bytes */
+size_t ucmatch_size(const ucmatch *m);
+
+/* Reports all (possibly overlapping) matches in UTF-8 text. Returns non-zero
+ * if scan was stopped by callback. */
+int ucmatch_scan_u8(const ucmatch *m, const char *text, size_t len, ucmatch_cb cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCMATCH_H */
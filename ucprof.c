@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ucprof.h"
+#include "/tmp/x_prof.h"
+
+#define NSLOTS	(sizeof(ucase_prof_slots) / sizeof(*ucase_prof_slots))
+#define BAR		50
+
+unsigned long ucase_prof_hits[NSLOTS];
+
+static const char *kinds[] = {"node", "below", "above", "hit", "prio"};
+
+const struct ucase_prof_slot *
+ucase_prof_slots_get(unsigned *n)
+{
+	*n = NSLOTS;
+	return ucase_prof_slots;
+}
+
+void
+ucase_prof_reset(void)
+{
+	unsigned i;
+	for (i = 0; i < NSLOTS; i++)
+		__atomic_store_n(&ucase_prof_hits[i], 0, __ATOMIC_RELAXED);
+}
+
+/* Snapshot being sorted by ucase_prof_dump() */
+static const unsigned long *sort_hits;
+
+static int
+cmp_hits(const void *a, const void *b)
+{
+	unsigned long l = sort_hits[*(const unsigned*)a], r = sort_hits[*(const unsigned*)b];
+	return l > r ? -1 : l < r;
+}
+
+static void
+bar(FILE *out, unsigned long v, unsigned long max)
+{
+	unsigned i, n = max ? (v * BAR + max - 1) / max : 0;
+	for (i = 0; i < n; i++)
+		fputc('#', out);
+	fputc('\n', out);
+}
+
+void
+ucase_prof_dump(FILE *out)
+{
+	unsigned long hits[NSLOTS], depth[256], total = 0, max = 0;
+	unsigned order[NSLOTS], i, n = 0, maxd = 0;
+	memset(depth, 0, sizeof(depth));
+	for (i = 0; i < NSLOTS; i++) {
+		hits[i] = __atomic_load_n(&ucase_prof_hits[i], __ATOMIC_RELAXED);
+		if (ucase_prof_slots[i].kind == UCASE_PROF_NODE)
+			continue;
+		/* Every call ends in exactly one leaf */
+		total += hits[i];
+		depth[ucase_prof_slots[i].depth] += hits[i];
+		if (ucase_prof_slots[i].depth > maxd)
+			maxd = ucase_prof_slots[i].depth;
+		if (hits[i] > max)
+			max = hits[i];
+		order[n++] = i;
+	}
+	sort_hits = hits;
+	qsort(order, n, sizeof(*order), cmp_hits);
+	fprintf(out, "%lu calls\n%-11s %-5s %5s %12s %6s\n", total, "interval", "kind", "depth", "hits", "%");
+	for (i = 0; i < n && hits[order[i]]; i++) {
+		const struct ucase_prof_slot *s = ucase_prof_slots + order[i];
+		fprintf(out, "%04X-%04X  %-5s %5u %12lu %5.1f%% ", s->first, s->last, kinds[s->kind],
+				s->depth, hits[order[i]], 100.0 * hits[order[i]] / total);
+		bar(out, hits[order[i]], max);
+	}
+	max = 0;
+	for (i = 0; i <= maxd; i++)
+		if (depth[i] > max)
+			max = depth[i];
+	fprintf(out, "depth %12s %6s\n", "hits", "%");
+	for (i = 0; i <= maxd; i++) {
+		fprintf(out, "%5u %12lu %5.1f%% ", i, depth[i], total ? 100.0 * depth[i] / total : 0.0);
+		bar(out, depth[i], max);
+	}
+}
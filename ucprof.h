@@ -0,0 +1,47 @@
+/*
+ * Hit counters of instrumented /tmp/x ("cf -i FILE").
+ *
+ * Every label and every leaf of the tree gets its own counter, incremented
+ * with relaxed atomic add, so instrumented code may run in production.
+ * Include this header before /tmp/x in functions that should be counted,
+ * elsewhere UCASE_HIT() expands to nothing.
+ */
+#ifndef __UCPROF_H
+#define __UCPROF_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	UCASE_PROF_NODE,	/* tree node (range_XXXX_XXXX label) entered */
+	UCASE_PROF_BELOW,	/* character below node interval and node has no left child */
+	UCASE_PROF_ABOVE,	/* character above node interval and node has no right child */
+	UCASE_PROF_HIT,		/* character inside node interval */
+	UCASE_PROF_PRIO		/* character inside priority interval (cf -p) */
+};
+
+struct ucase_prof_slot {
+	unsigned		first;
+	unsigned		last;
+	unsigned char	depth;	/* 1 for root, 0 for priority intervals */
+	unsigned char	kind;
+};
+
+extern unsigned long ucase_prof_hits[];
+
+#define UCASE_HIT(n)	__atomic_fetch_add(&ucase_prof_hits[n], 1, __ATOMIC_RELAXED)
+
+/* Descriptions of counters, *n receives their number */
+const struct ucase_prof_slot *ucase_prof_slots_get(unsigned *n);
+void ucase_prof_reset(void);
+/* Prints leaves ordered by hits and histogram of leaf hits by tree depth */
+void ucase_prof_dump(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCPROF_H */
@@ -0,0 +1,89 @@
+#include "ucrun.h"
+#include "ucbatch.h"
+#include "ucutf8.h"
+#include "/tmp/ucase_nodes.h"
+
+#define NODES	(sizeof(ucase_nodes) / sizeof(*ucase_nodes))
+
+static void
+run_identity(struct ucase_run *r, uint32_t first, uint32_t last)
+{
+	r->first = first;
+	r->last = last;
+	r->kind = UCBLOB_DELTA;
+	r->arg = 0;
+	r->tbl_first = 1;
+	r->tbl_last = 0;
+	r->tbl = ucase_node_data;
+}
+
+void
+ucase_run_init(struct ucase_run *r)
+{
+	/* Nothing below the first node is folded */
+	run_identity(r, 0, ucase_nodes[0].first - 1);
+}
+
+void
+ucase_run_seek(struct ucase_run *r, uint32_t c)
+{
+	const struct ucblob_node *n;
+	unsigned lo = 0, hi = NODES;
+	/* Find last node with first <= c */
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (ucase_nodes[mid].first <= c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo || c > ucase_nodes[lo - 1].last) {
+		/* Gap up to the next node */
+		run_identity(r, lo ? ucase_nodes[lo - 1].last + 1 : 0,
+				lo < NODES ? ucase_nodes[lo].first - 1 : 0xFFFFFFFFu);
+		return;
+	}
+	n = ucase_nodes + lo - 1;
+	r->first = n->first;
+	r->last = n->last;
+	r->kind = n->kind;
+	r->arg = n->arg;
+	r->tbl_first = n->tbl_first;
+	r->tbl_last = n->tbl_last;
+	r->tbl = ucase_node_data + n->tbl;
+}
+
+void
+ucase_fold_u32_run(const uint32_t *in, uint32_t *out, size_t n)
+{
+	/* Local copy lets compiler keep the cursor in registers */
+	struct ucase_run r;
+	size_t i;
+	ucase_run_init(&r);
+	for (i = 0; i < n; i++)
+		out[i] = ucase_run_fold(&r, in[i]);
+}
+
+long
+ucase_fold_u8_run(const char *in, size_t len, char *out, size_t out_cap)
+{
+	const unsigned char *src = (const unsigned char*)in, *end = src + len;
+	unsigned char *dst = (unsigned char*)out;
+	struct ucase_run r;
+	if (out_cap < UCASE_FOLD_BOUND(len))
+		return -1;
+	ucase_run_init(&r);
+	while (src < end) {
+		unsigned c = *src;
+		if (c < 0x80) {
+			/* ASCII does not disturb the cursor */
+			*dst++ = c - 'A' < 26 ? c + 0x20 : c;
+			src++;
+			continue;
+		}
+		/* Malformed bytes are copied as is and do not disturb it either */
+		src += u8_dec(src, end - src, &c);
+		dst += u8_enc(dst, c < U8_RAW ? ucase_run_fold(&r, c) : c);
+	}
+	return dst - (unsigned char*)out;
+}
@@ -0,0 +1,64 @@
+/*
+ * Stateful folding of strings.
+ *
+ * Text rarely jumps between scripts, so interval of the previous character
+ * (from "cf -n", the same intervals as in the blob) is kept in a cursor along
+ * with its mapping. Next character is checked against cached bounds first and
+ * binary search over intervals is only done when it leaves the interval. Characters
+ * between intervals are cached as identity interval as well.
+ */
+#ifndef __UCRUN_H
+#define __UCRUN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ucblob.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ucase_run {
+	uint32_t	first;		/* cached interval */
+	uint32_t	last;
+	uint32_t	kind;		/* enum ucblob_kind, identity is UCBLOB_DELTA by 0 */
+	int32_t		arg;
+	uint32_t	tbl_first;	/* tbl[0] is value for tbl_first */
+	uint32_t	tbl_last;
+	const uint32_t	*tbl;
+};
+
+/* Points cursor to the characters below the first interval */
+void ucase_run_init(struct ucase_run *r);
+/* Loads interval containing c into cursor */
+void ucase_run_seek(struct ucase_run *r, uint32_t c);
+
+static inline uint32_t
+ucase_run_fold(struct ucase_run *r, uint32_t c)
+{
+	if (c - r->first > r->last - r->first)
+		ucase_run_seek(r, c);
+	if (c >= r->tbl_first && c <= r->tbl_last)
+		return r->tbl[c - r->tbl_first];
+	switch (r->kind) {
+	case UCBLOB_SET:
+		return c | 1;
+	case UCBLOB_RESET:
+		return c & ~1u;
+	case UCBLOB_SINGLE:
+		return r->arg;
+	}
+	return c + r->arg;
+}
+
+/* Folds n code points from in to out, in == out is allowed */
+void ucase_fold_u32_run(const uint32_t *in, uint32_t *out, size_t n);
+/* Folds UTF-8 string, malformed bytes are copied as is. Returns number of
+ * bytes written or -1 if out_cap is less than UCASE_FOLD_BOUND(len) (ucbatch.h). */
+long ucase_fold_u8_run(const char *in, size_t len, char *out, size_t out_cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCRUN_H */
@@ -0,0 +1,635 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "uctrie.h"
+#include "ucutf8.h"
+
+/* Compressed path bytes kept in node, longer paths are checked against leaf */
+#define MAX_PREFIX	8
+
+enum { NODE4 = 1, NODE16, NODE48, NODE256 };
+
+/* Children are either nodes or leaves, leaves are tagged with low bit */
+#define IS_LEAF(p)	((uintptr_t)(p) & 1)
+#define LEAF(p)		((struct leaf*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define TAG(l)		((void*)((uintptr_t)(l) | 1))
+
+struct leaf {
+	void		*value;
+	uint32_t	len;
+	unsigned char	key[];
+};
+
+struct node {
+	uint8_t		type;
+	uint16_t	count;
+	uint32_t	plen;
+	unsigned char	prefix[MAX_PREFIX];
+	struct leaf	*leaf;		/* key that ends at this node */
+};
+
+struct node4 {
+	struct node		n;
+	unsigned char	keys[4];
+	void			*child[4];
+};
+
+struct node16 {
+	struct node		n;
+	unsigned char	keys[16];
+	void			*child[16];
+};
+
+struct node48 {
+	struct node		n;
+	unsigned char	index[256];	/* slot + 1, 0 if none */
+	void			*child[48];
+};
+
+struct node256 {
+	struct node		n;
+	void			*child[256];
+};
+
+struct uctrie {
+	void	*root;
+	size_t	size;
+};
+
+static unsigned
+uctrie_fold(unsigned c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+/* Folds next character of s into dst, returns number of bytes written */
+static unsigned
+fold_char(const unsigned char **s, const unsigned char *end, unsigned char *dst)
+{
+	unsigned c;
+	*s += u8_dec(*s, end - *s, &c);
+	return u8_enc(dst, uctrie_fold(c));
+}
+
+/* Stream of folded bytes of the lookup key */
+struct fstream {
+	const unsigned char	*p, *end;
+	unsigned char		buf[4];
+	unsigned			pos, len;
+};
+
+static void
+fs_init(struct fstream *fs, const char *s, size_t len)
+{
+	fs->p = (const unsigned char*)s;
+	fs->end = fs->p + len;
+	fs->pos = fs->len = 0;
+}
+
+static int
+fs_next(struct fstream *fs)
+{
+	if (fs->pos == fs->len) {
+		if (fs->p >= fs->end)
+			return -1;
+		fs->len = fold_char(&fs->p, fs->end, fs->buf);
+		fs->pos = 0;
+	}
+	return fs->buf[fs->pos++];
+}
+
+/* Compares the whole folded key with leaf, if "prefix" is set the key only has to be prefix of leaf */
+static int
+leaf_match(const struct leaf *l, const char *key, size_t len, int prefix)
+{
+	struct fstream fs;
+	uint32_t i = 0;
+	int b;
+	fs_init(&fs, key, len);
+	while ((b = fs_next(&fs)) >= 0) {
+		if (i >= l->len || l->key[i] != b)
+			return 0;
+		i++;
+	}
+	return prefix || i == l->len;
+}
+
+static void **
+find_child(struct node *n, unsigned char b)
+{
+	int i;
+	switch (n->type) {
+	case NODE4: {
+		struct node4 *p = (struct node4*)n;
+		for (i = 0; i < n->count; i++)
+			if (p->keys[i] == b)
+				return &p->child[i];
+		break;
+	}
+	case NODE16: {
+		struct node16 *p = (struct node16*)n;
+#ifdef __SSE2__
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(b),
+					_mm_loadu_si128((const __m128i*)p->keys))) & ((1u << n->count) - 1);
+		if (mask)
+			return &p->child[__builtin_ctz(mask)];
+#else
+		for (i = 0; i < n->count; i++)
+			if (p->keys[i] == b)
+				return &p->child[i];
+#endif
+		break;
+	}
+	case NODE48: {
+		struct node48 *p = (struct node48*)n;
+		if (p->index[b])
+			return &p->child[p->index[b] - 1];
+		break;
+	}
+	case NODE256: {
+		struct node256 *p = (struct node256*)n;
+		if (p->child[b])
+			return &p->child[b];
+		break;
+	}
+	}
+	return NULL;
+}
+
+static struct node *
+node_new(uctrie *t, int type)
+{
+	static const size_t sizes[] = {0, sizeof(struct node4), sizeof(struct node16),
+		sizeof(struct node48), sizeof(struct node256)};
+	struct node *n = calloc(1, sizes[type]);
+	if (n) {
+		n->type = type;
+		t->size += sizes[type];
+	}
+	return n;
+}
+
+static void
+node_free(uctrie *t, struct node *n, size_t size)
+{
+	t->size -= size;
+	free(n);
+}
+
+/* Any leaf below n, all of them share path down to n */
+static struct leaf *
+minimum(const void *p)
+{
+	const struct node *n;
+	while (!IS_LEAF(p)) {
+		n = (const struct node*)p;
+		if (n->leaf)
+			return n->leaf;
+		switch (n->type) {
+		case NODE4:
+			p = ((const struct node4*)n)->child[0];
+			break;
+		case NODE16:
+			p = ((const struct node16*)n)->child[0];
+			break;
+		case NODE48: {
+			const struct node48 *n48 = (const struct node48*)n;
+			int i = 0;
+			while (!n48->index[i])
+				i++;
+			p = n48->child[n48->index[i] - 1];
+			break;
+		}
+		case NODE256: {
+			const struct node256 *n256 = (const struct node256*)n;
+			int i = 0;
+			while (!n256->child[i])
+				i++;
+			p = n256->child[i];
+			break;
+		}
+		}
+	}
+	return LEAF(p);
+}
+
+static int
+add_child(uctrie *t, void **ref, struct node *n, unsigned char b, void *child);
+
+static int
+add_sorted(unsigned char *keys, void **children, int count, unsigned char b, void *child)
+{
+	int i = 0;
+	while (i < count && keys[i] < b)
+		i++;
+	memmove(keys + i + 1, keys + i, count - i);
+	memmove(children + i + 1, children + i, (count - i) * sizeof(*children));
+	keys[i] = b;
+	children[i] = child;
+	return count + 1;
+}
+
+static int
+add_child(uctrie *t, void **ref, struct node *n, unsigned char b, void *child)
+{
+	int i;
+	switch (n->type) {
+	case NODE4: {
+		struct node4 *p = (struct node4*)n;
+		struct node16 *nn;
+		if (n->count < 4) {
+			n->count = add_sorted(p->keys, p->child, n->count, b, child);
+			return 0;
+		}
+		if (!(nn = (struct node16*)node_new(t, NODE16)))
+			return -1;
+		nn->n = *n;
+		nn->n.type = NODE16;
+		memcpy(nn->keys, p->keys, 4);
+		memcpy(nn->child, p->child, 4 * sizeof(*p->child));
+		*ref = nn;
+		node_free(t, n, sizeof(*p));
+		return add_child(t, ref, &nn->n, b, child);
+	}
+	case NODE16: {
+		struct node16 *p = (struct node16*)n;
+		struct node48 *nn;
+		if (n->count < 16) {
+			n->count = add_sorted(p->keys, p->child, n->count, b, child);
+			return 0;
+		}
+		if (!(nn = (struct node48*)node_new(t, NODE48)))
+			return -1;
+		nn->n = *n;
+		nn->n.type = NODE48;
+		for (i = 0; i < 16; i++) {
+			nn->child[i] = p->child[i];
+			nn->index[p->keys[i]] = i + 1;
+		}
+		*ref = nn;
+		node_free(t, n, sizeof(*p));
+		return add_child(t, ref, &nn->n, b, child);
+	}
+	case NODE48: {
+		struct node48 *p = (struct node48*)n;
+		struct node256 *nn;
+		if (n->count < 48) {
+			for (i = 0; p->child[i]; i++)
+				;
+			p->child[i] = child;
+			p->index[b] = i + 1;
+			n->count++;
+			return 0;
+		}
+		if (!(nn = (struct node256*)node_new(t, NODE256)))
+			return -1;
+		nn->n = *n;
+		nn->n.type = NODE256;
+		for (i = 0; i < 256; i++)
+			if (p->index[i])
+				nn->child[i] = p->child[p->index[i] - 1];
+		*ref = nn;
+		node_free(t, n, sizeof(*p));
+		return add_child(t, ref, &nn->n, b, child);
+	}
+	case NODE256: {
+		struct node256 *p = (struct node256*)n;
+		p->child[b] = child;
+		n->count++;
+		return 0;
+	}
+	}
+	return -1;
+}
+
+/* Puts leaf into node that has already consumed "depth" bytes of its key */
+static int
+add_leaf(uctrie *t, void **ref, struct node *n, struct leaf *l, uint32_t depth)
+{
+	if (l->len == depth) {
+		n->leaf = l;
+		return 0;
+	}
+	return add_child(t, ref, n, l->key[depth], TAG(l));
+}
+
+/* Number of bytes of key after depth that match compressed path of n */
+static uint32_t
+prefix_mismatch(const struct node *n, const struct leaf *l, uint32_t depth)
+{
+	uint32_t max = n->plen < MAX_PREFIX ? n->plen : MAX_PREFIX, i;
+	const struct leaf *ml;
+	if (max > l->len - depth)
+		max = l->len - depth;
+	for (i = 0; i < max; i++)
+		if (n->prefix[i] != l->key[depth + i])
+			return i;
+	if (n->plen > MAX_PREFIX) {
+		ml = minimum(n);
+		max = (ml->len < l->len ? ml->len : l->len) - depth;
+		for (; i < max && i < n->plen; i++)
+			if (ml->key[depth + i] != l->key[depth + i])
+				return i;
+	}
+	return i;
+}
+
+static int
+insert(uctrie *t, void **ref, struct leaf *l, uint32_t depth, void **old)
+{
+	struct node *n = (struct node*)*ref, *nn;
+	void **child;
+	uint32_t p;
+	if (!n) {
+		*ref = TAG(l);
+		return 0;
+	}
+	if (IS_LEAF(n)) {
+		struct leaf *e = LEAF(n);
+		uint32_t max = e->len < l->len ? e->len : l->len;
+		if (e->len == l->len && memcmp(e->key, l->key, l->len) == 0) {
+			*old = e->value;
+			e->value = l->value;
+			t->size -= sizeof(*l) + l->len;
+			free(l);
+			return 0;
+		}
+		for (p = depth; p < max && e->key[p] == l->key[p]; p++)
+			;
+		if (!(nn = node_new(t, NODE4)))
+			return -1;
+		nn->plen = p - depth;
+		memcpy(nn->prefix, l->key + depth, nn->plen < MAX_PREFIX ? nn->plen : MAX_PREFIX);
+		*ref = nn;
+		if (add_leaf(t, ref, nn, e, p) || add_leaf(t, ref, nn, l, p))
+			return -1;
+		return 0;
+	}
+	if (n->plen) {
+		p = prefix_mismatch(n, l, depth);
+		if (p < n->plen) {
+			if (!(nn = node_new(t, NODE4)))
+				return -1;
+			nn->plen = p;
+			memcpy(nn->prefix, n->prefix, p < MAX_PREFIX ? p : MAX_PREFIX);
+			if (n->plen <= MAX_PREFIX) {
+				add_child(t, ref, nn, n->prefix[p], n);
+				n->plen -= p + 1;
+				memmove(n->prefix, n->prefix + p + 1, n->plen);
+			} else {
+				const struct leaf *ml = minimum(n);
+				add_child(t, ref, nn, ml->key[depth + p], n);
+				n->plen -= p + 1;
+				memcpy(n->prefix, ml->key + depth + p + 1, n->plen < MAX_PREFIX ? n->plen : MAX_PREFIX);
+			}
+			*ref = nn;
+			return add_leaf(t, ref, nn, l, depth + p);
+		}
+		depth += n->plen;
+	}
+	if (depth == l->len) {
+		if (n->leaf) {
+			*old = n->leaf->value;
+			n->leaf->value = l->value;
+			t->size -= sizeof(*l) + l->len;
+			free(l);
+		} else {
+			n->leaf = l;
+		}
+		return 0;
+	}
+	child = find_child(n, l->key[depth]);
+	if (child)
+		return insert(t, child, l, depth + 1, old);
+	return add_child(t, ref, n, l->key[depth], TAG(l));
+}
+
+uctrie *
+uctrie_new(void)
+{
+	return calloc(1, sizeof(uctrie));
+}
+
+static void
+free_tree(void *p)
+{
+	struct node *n = (struct node*)p;
+	int i;
+	if (!p)
+		return;
+	if (IS_LEAF(p)) {
+		free(LEAF(p));
+		return;
+	}
+	free(n->leaf);
+	switch (n->type) {
+	case NODE4:
+	case NODE16:
+		for (i = 0; i < n->count; i++)
+			free_tree(n->type == NODE4 ? ((struct node4*)n)->child[i] : ((struct node16*)n)->child[i]);
+		break;
+	case NODE48:
+		for (i = 0; i < n->count; i++)
+			free_tree(((struct node48*)n)->child[i]);
+		break;
+	case NODE256:
+		for (i = 0; i < 256; i++)
+			free_tree(((struct node256*)n)->child[i]);
+		break;
+	}
+	free(n);
+}
+
+void
+uctrie_free(uctrie *t)
+{
+	if (t) {
+		free_tree(t->root);
+		free(t);
+	}
+}
+
+int
+uctrie_insert(uctrie *t, const char *key, size_t len, void *value, void **old)
+{
+	const unsigned char *s = (const unsigned char*)key, *end = s + len;
+	unsigned char buf[256], *tmp = buf;
+	struct leaf *l;
+	size_t n = 0;
+	if (old)
+		*old = NULL;
+	/* Key is folded into scratch buffer first, so leaf takes exactly its size */
+	if (len * 3 / 2 + 4 > sizeof(buf) && !(tmp = malloc(len * 3 / 2 + 4)))
+		return -1;
+	while (s < end)
+		n += fold_char(&s, end, tmp + n);
+	l = malloc(sizeof(*l) + n);
+	if (l) {
+		l->value = value;
+		l->len = n;
+		memcpy(l->key, tmp, n);
+	}
+	if (tmp != buf)
+		free(tmp);
+	if (!l)
+		return -1;
+	t->size += sizeof(*l) + l->len;
+	{
+		void *dummy;
+		return insert(t, &t->root, l, 0, old ? old : &dummy);
+	}
+}
+
+void *
+uctrie_lookup(const uctrie *t, const char *key, size_t len)
+{
+	struct fstream fs;
+	const void *p = t->root;
+	fs_init(&fs, key, len);
+	while (p) {
+		const struct node *n;
+		void **child;
+		uint32_t i;
+		int b;
+		if (IS_LEAF(p))
+			return leaf_match(LEAF(p), key, len, 0) ? LEAF(p)->value : NULL;
+		n = (const struct node*)p;
+		/* Stored part of compressed path is checked right away, the rest by leaf */
+		for (i = 0; i < n->plen; i++) {
+			if ((b = fs_next(&fs)) < 0)
+				return NULL;
+			if (i < MAX_PREFIX && n->prefix[i] != b)
+				return NULL;
+		}
+		if ((b = fs_next(&fs)) < 0)
+			return n->leaf && leaf_match(n->leaf, key, len, 0) ? n->leaf->value : NULL;
+		child = find_child((struct node*)n, b);
+		p = child ? *child : NULL;
+	}
+	return NULL;
+}
+
+static int
+iterate(const void *p, uctrie_cb cb, void *arg)
+{
+	const struct node *n = (const struct node*)p;
+	int i;
+	if (IS_LEAF(p))
+		return cb(LEAF(p)->key, LEAF(p)->len, LEAF(p)->value, arg);
+	if (n->leaf && cb(n->leaf->key, n->leaf->len, n->leaf->value, arg))
+		return 1;
+	switch (n->type) {
+	case NODE4:
+		for (i = 0; i < n->count; i++)
+			if (iterate(((const struct node4*)n)->child[i], cb, arg))
+				return 1;
+		break;
+	case NODE16:
+		for (i = 0; i < n->count; i++)
+			if (iterate(((const struct node16*)n)->child[i], cb, arg))
+				return 1;
+		break;
+	case NODE48: {
+		const struct node48 *n48 = (const struct node48*)n;
+		for (i = 0; i < 256; i++)
+			if (n48->index[i] && iterate(n48->child[n48->index[i] - 1], cb, arg))
+				return 1;
+		break;
+	}
+	case NODE256:
+		for (i = 0; i < 256; i++)
+			if (((const struct node256*)n)->child[i] && iterate(((const struct node256*)n)->child[i], cb, arg))
+				return 1;
+		break;
+	}
+	return 0;
+}
+
+int
+uctrie_prefix(const uctrie *t, const char *prefix, size_t len, uctrie_cb cb, void *arg)
+{
+	struct fstream fs;
+	const void *p = t->root;
+	fs_init(&fs, prefix, len);
+	while (p) {
+		const struct node *n;
+		void **child;
+		uint32_t i;
+		int b;
+		if (IS_LEAF(p))
+			return leaf_match(LEAF(p), prefix, len, 1) ? cb(LEAF(p)->key, LEAF(p)->len, LEAF(p)->value, arg) : 0;
+		n = (const struct node*)p;
+		for (i = 0; i < n->plen; i++) {
+			if ((b = fs_next(&fs)) < 0)
+				break;
+			if (i < MAX_PREFIX && n->prefix[i] != b)
+				return 0;
+		}
+		if (i < n->plen || (b = fs_next(&fs)) < 0) {
+			/* Prefix ends in this node, all keys below match if any of them does */
+			return leaf_match(minimum(n), prefix, len, 1) ? iterate(n, cb, arg) : 0;
+		}
+		child = find_child((struct node*)n, b);
+		p = child ? *child : NULL;
+	}
+	return 0;
+}
+
+size_t
+uctrie_size(const uctrie *t)
+{
+	return sizeof(*t) + t->size;
+}
+
+static void
+stats(const void *p, struct uctrie_stats *st)
+{
+	const struct node *n = (const struct node*)p;
+	int i;
+	if (IS_LEAF(p)) {
+		st->leaves++;
+		st->key_bytes += LEAF(p)->len;
+		return;
+	}
+	if (n->leaf) {
+		st->leaves++;
+		st->key_bytes += n->leaf->len;
+	}
+	switch (n->type) {
+	case NODE4:
+		st->node4++;
+		for (i = 0; i < n->count; i++)
+			stats(((const struct node4*)n)->child[i], st);
+		break;
+	case NODE16:
+		st->node16++;
+		for (i = 0; i < n->count; i++)
+			stats(((const struct node16*)n)->child[i], st);
+		break;
+	case NODE48:
+		st->node48++;
+		for (i = 0; i < n->count; i++)
+			stats(((const struct node48*)n)->child[i], st);
+		break;
+	case NODE256:
+		st->node256++;
+		for (i = 0; i < 256; i++)
+			if (((const struct node256*)n)->child[i])
+				stats(((const struct node256*)n)->child[i], st);
+		break;
+	}
+}
+
+void
+uctrie_stats(const uctrie *t, struct uctrie_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	if (t->root)
+		stats(t->root, st);
+	st->bytes = uctrie_size(t);
+}
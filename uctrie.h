@@ -0,0 +1,52 @@
+/*
+ * Case insensitive adaptive radix trie.
+ *
+ * Keys are stored once, in folded UTF-8 form, in leaves of the trie. Lookup
+ * keys are folded character by character while the trie is traversed, so
+ * neither caller nor trie keeps a folded copy of anything.
+ * Bytes of malformed UTF-8 are kept as they are and never equal a letter.
+ */
+#ifndef __UCTRIE_H
+#define __UCTRIE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct uctrie uctrie;
+
+/* Called for every key in order of folded keys, non-zero return value stops iteration */
+typedef int (*uctrie_cb)(const unsigned char *key, size_t len, void *value, void *arg);
+
+struct uctrie_stats {
+	size_t	node4;
+	size_t	node16;
+	size_t	node48;
+	size_t	node256;
+	size_t	leaves;
+	size_t	key_bytes;	/* folded keys stored in leaves */
+	size_t	bytes;		/* total memory used by nodes and leaves */
+};
+
+uctrie *uctrie_new(void);
+/* Frees trie, values are not touched */
+void uctrie_free(uctrie *t);
+
+/* Inserts UTF-8 key. If folded key is already there its value is replaced and
+ * old value is stored into *old (NULL otherwise). Returns 0 or -1 on allocation failure. */
+int uctrie_insert(uctrie *t, const char *key, size_t len, void *value, void **old);
+/* Returns value for key or NULL */
+void *uctrie_lookup(const uctrie *t, const char *key, size_t len);
+/* Calls cb for every key starting with prefix (case insensitive), returns
+ * non-zero if iteration was stopped by callback */
+int uctrie_prefix(const uctrie *t, const char *prefix, size_t len, uctrie_cb cb, void *arg);
+size_t uctrie_size(const uctrie *t);
+void uctrie_stats(const uctrie *t, struct uctrie_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCTRIE_H */
@@ -0,0 +1,56 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "ucu32.h"
+#include "/tmp/ucg.h"
+
+static uint32_t
+ucu32_tree(uint32_t c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+static inline uint32_t
+ucu32_fold(uint32_t c)
+{
+	if (c > 0xFFFF)
+		return ucu32_tree(c);
+	return (c + ucg_stage2[ucg_stage1[c >> 8] + (c & 0xFF)]) & 0xFFFF;
+}
+
+void
+ucase_fold_u32(const uint32_t *in, uint32_t *out, size_t n)
+{
+	size_t i = 0;
+#ifdef __AVX2__
+	const __m256i bmp = _mm256_set1_epi32(0xFFFF);
+	const __m256i lo = _mm256_set1_epi32(0xFF);
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+		__m256i hi = _mm256_srli_epi32(v, 8);
+		__m256i sup = _mm256_cmpgt_epi32(hi, lo);
+		/* Supplementary lanes look up high byte 0 and are dropped from the mask,
+		 * they are fixed below */
+		__m256i blk = _mm256_i32gather_epi32(ucg_stage1, _mm256_andnot_si256(sup, hi), 4);
+		__m256i act = _mm256_andnot_si256(sup, _mm256_cmpgt_epi32(blk, _mm256_setzero_si256()));
+		unsigned smask = _mm256_movemask_ps(_mm256_castsi256_ps(sup));
+		if (!_mm256_testz_si256(act, act)) {
+			/* 16-bit deltas are fetched by 32-bit gather, upper half belongs to next entry */
+			__m256i idx = _mm256_add_epi32(blk, _mm256_and_si256(v, lo));
+			__m256i d = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+					(const int*)ucg_stage2, idx, act, 2);
+			v = _mm256_blendv_epi8(v, _mm256_and_si256(_mm256_add_epi32(v, d), bmp), act);
+		}
+		_mm256_storeu_si256((__m256i*)(out + i), v);
+		while (smask) {
+			unsigned j = __builtin_ctz(smask);
+			out[i + j] = ucu32_tree(in[i + j]);
+			smask &= smask - 1;
+		}
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = ucu32_fold(in[i]);
+}
@@ -0,0 +1,26 @@
+/*
+ * Folding of UTF-32 arrays.
+ *
+ * With AVX2 eight code points are folded at once: delta for every BMP lane is
+ * fetched by two gathers from two-level table generated by "cf -g", lanes in
+ * identity blocks are left as is and supplementary code points go through
+ * the tree from /tmp/x.
+ */
+#ifndef __UCU32_H
+#define __UCU32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Folds n code points from in to out, in == out is allowed */
+void ucase_fold_u32(const uint32_t *in, uint32_t *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCU32_H */
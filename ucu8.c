@@ -0,0 +1,140 @@
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include <string.h>
+
+#include "ucu8.h"
+#include "ucbatch.h"
+#include "ucutf8.h"
+#include "/tmp/u8f.h"
+
+#ifdef __SSSE3__
+/* Error bits of byte pair classification */
+#define TOO_SHORT	(1 << 0)	/* lead byte not followed by continuation */
+#define TOO_LONG	(1 << 1)	/* ASCII followed by continuation */
+#define OVERLONG_3	(1 << 2)
+#define TOO_LARGE	(1 << 3)
+#define SURROGATE	(1 << 4)
+#define OVERLONG_2	(1 << 5)
+#define TOO_LARGE_1000	(1 << 6)
+#define OVERLONG_4	(1 << 6)
+#define TWO_CONTS	(1 << 7)	/* continuation that must be checked by length */
+#define CARRY		(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static inline __m128i
+nibble_lookup(__m128i idx, char t0, char t1, char t2, char t3, char t4, char t5, char t6, char t7,
+		char t8, char t9, char t10, char t11, char t12, char t13, char t14, char t15)
+{
+	return _mm_shuffle_epi8(_mm_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7,
+			t8, t9, t10, t11, t12, t13, t14, t15), idx);
+}
+
+/* Non-zero if 16 bytes at s have an error. Bytes before s are taken for ASCII,
+ * so s must be at sequence boundary; sequence cut by the end of block is not
+ * an error here. */
+static inline int
+u8_block_bad(__m128i in)
+{
+	const __m128i lo4 = _mm_set1_epi8(0x0F);
+	__m128i prev1 = _mm_alignr_epi8(in, _mm_setzero_si128(), 15);
+	__m128i prev2 = _mm_alignr_epi8(in, _mm_setzero_si128(), 14);
+	__m128i prev3 = _mm_alignr_epi8(in, _mm_setzero_si128(), 13);
+	__m128i b1h = nibble_lookup(_mm_and_si128(_mm_srli_epi16(prev1, 4), lo4),
+			TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+			TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+			TOO_SHORT | OVERLONG_2,
+			TOO_SHORT,
+			TOO_SHORT | OVERLONG_3 | SURROGATE,
+			TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+	__m128i b1l = nibble_lookup(_mm_and_si128(prev1, lo4),
+			CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+			CARRY | OVERLONG_2,
+			CARRY,
+			CARRY,
+			CARRY | TOO_LARGE,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+			CARRY | TOO_LARGE | TOO_LARGE_1000,
+			CARRY | TOO_LARGE | TOO_LARGE_1000);
+	__m128i b2h = nibble_lookup(_mm_and_si128(_mm_srli_epi16(in, 4), lo4),
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+	__m128i sc = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+	/* Third and fourth bytes of long sequences must be continuations (TWO_CONTS
+	 * above), the rest of continuation pairs are errors */
+	__m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+	__m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+	__m128i must = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(0x80));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_xor_si128(must, sc), _mm_setzero_si128())) != 0xFFFF;
+}
+#endif
+
+long
+ucase_fold_u8(const char *in, size_t len, char *out, size_t out_cap,
+		enum ucase_u8_policy policy, size_t *bad)
+{
+	const unsigned char *src = (const unsigned char*)in, *end = src + len;
+	unsigned char *dst = (unsigned char*)out;
+	if (out_cap < (policy == UCASE_U8_REPLACE ? UCASE_FOLD_U8_BOUND(len) : UCASE_FOLD_BOUND(len)))
+		return -1;
+	while (src < end) {
+		const unsigned char *stop = end;
+#ifdef __SSSE3__
+		if (end - src >= 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)src);
+			if (u8_fold_ascii16(x, dst)) {
+				src += 16;
+				dst += 16;
+				continue;
+			}
+			stop = src + 16;
+			if (!u8_block_bad(x)) {
+				/* Sequence cut by the end of block is checked with the next one */
+				while (src < stop) {
+					unsigned n = *src < 0x80 ? 1 : *src < 0xE0 ? 2 : *src < 0xF0 ? 3 : 4;
+					if (src + n > stop)
+						break;
+					u8f_fold_char(&src, &dst);
+				}
+				continue;
+			}
+		}
+#endif
+		/* Scalar decoder up to the end of block */
+		while (src < stop) {
+			int n = u8_check(src, end);
+			if (n > 0) {
+				u8f_fold_char(&src, &dst);
+				continue;
+			}
+			switch (policy) {
+			case UCASE_U8_FAIL:
+				if (bad)
+					*bad = src - (const unsigned char*)in;
+				return -2;
+			case UCASE_U8_REPLACE:
+				*dst++ = 0xEF;
+				*dst++ = 0xBF;
+				*dst++ = 0xBD;
+				break;
+			case UCASE_U8_PASS:
+				memcpy(dst, src, -n);
+				dst += -n;
+				break;
+			}
+			src += -n;
+		}
+	}
+	return dst - (unsigned char*)out;
+}
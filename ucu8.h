@@ -0,0 +1,42 @@
+/*
+ * Folding of untrusted UTF-8 with validation in the same pass.
+ *
+ * With SSSE3 input is checked 16 bytes at a time by nibble lookup tables
+ * (every pair of adjacent bytes is classified by high and low nibble of the
+ * first and high nibble of the second one, plus a check that 3rd and 4th bytes
+ * of long sequences are continuations), blocks without errors are folded by
+ * the automaton from "cf -u" and only blocks with errors are walked by scalar
+ * decoder. Invalid input is handled according to policy at the granularity of
+ * maximal subparts (Unicode 6.1, section 3.9), the way ICU and WHATWG do.
+ */
+#ifndef __UCU8_H
+#define __UCU8_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum ucase_u8_policy {
+	UCASE_U8_FAIL = 0,	/* stop at the first invalid sequence */
+	UCASE_U8_REPLACE,	/* write U+FFFD instead of every maximal subpart */
+	UCASE_U8_PASS		/* copy invalid bytes as is */
+};
+
+/* Output size that is always enough for len bytes of input with any policy:
+ * single byte may become 3-byte U+FFFD */
+#define UCASE_FOLD_U8_BOUND(len)	((len) * 3)
+
+/* Folds UTF-8 string. Returns number of bytes written, -1 if out_cap is less than
+ * UCASE_FOLD_U8_BOUND(len) (UCASE_FOLD_BOUND(len) from ucbatch.h is enough for
+ * UCASE_U8_FAIL and UCASE_U8_PASS) or -2 if input is invalid and policy is
+ * UCASE_U8_FAIL, *bad receives offset of the first invalid byte then. */
+long ucase_fold_u8(const char *in, size_t len, char *out, size_t out_cap,
+		enum ucase_u8_policy policy, size_t *bad);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCU8_H */
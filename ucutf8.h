@@ -0,0 +1,117 @@
+/*
+ * UTF-8 helpers shared by the string modules (not installed).
+ *
+ * Well formed is what Unicode 6.1, section 3.9 says: no overlongs, surrogates
+ * or code points above U+10FFFF. Every byte that is not part of well formed
+ * sequence is decoded alone as U8_RAW + byte, which never folds and never
+ * equals a character, so malformed input can't match letters.
+ */
+#ifndef __UCUTF8_H
+#define __UCUTF8_H
+
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Decoded malformed byte b is U8_RAW + b */
+#define U8_RAW	0x110000
+
+/* Returns length of well formed sequence at s or minus length of its maximal
+ * subpart (at least 1) */
+static inline int
+u8_check(const unsigned char *s, const unsigned char *end)
+{
+	unsigned c = *s, n, i;
+	unsigned char lo = 0x80, hi = 0xBF;
+	if (c < 0x80)
+		return 1;
+	if (c < 0xC2 || c > 0xF4)
+		return -1;
+	n = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+	/* Overlongs, surrogates and code points above U+10FFFF are excluded by the
+	 * range of the second byte */
+	if (c == 0xE0)
+		lo = 0xA0;
+	else if (c == 0xED)
+		hi = 0x9F;
+	else if (c == 0xF0)
+		lo = 0x90;
+	else if (c == 0xF4)
+		hi = 0x8F;
+	for (i = 1; i < n; i++) {
+		if (s + i >= end || s[i] < lo || s[i] > hi)
+			return -(int)i;
+		lo = 0x80;
+		hi = 0xBF;
+	}
+	return n;
+}
+
+/* Decodes character at s[0..len), returns number of bytes taken */
+static inline unsigned
+u8_dec(const unsigned char *s, size_t len, unsigned *c)
+{
+	int n = u8_check(s, s + len);
+	switch (n) {
+	case 1:
+		*c = s[0];
+		return 1;
+	case 2:
+		*c = ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+		return 2;
+	case 3:
+		*c = ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+		return 3;
+	case 4:
+		*c = ((s[0] & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+		return 4;
+	}
+	*c = U8_RAW + s[0];
+	return 1;
+}
+
+/* Encodes c as decoded by u8_dec, returns number of bytes written */
+static inline unsigned
+u8_enc(unsigned char *dst, unsigned c)
+{
+	if (c <= 0x7F) {
+		dst[0] = c;
+		return 1;
+	} else if (c <= 0x7FF) {
+		dst[0] = 0xC0 | (c >> 6);
+		dst[1] = 0x80 | (c & 0x3F);
+		return 2;
+	} else if (c <= 0xFFFF) {
+		dst[0] = 0xE0 | (c >> 12);
+		dst[1] = 0x80 | ((c >> 6) & 0x3F);
+		dst[2] = 0x80 | (c & 0x3F);
+		return 3;
+	} else if (c < U8_RAW) {
+		dst[0] = 0xF0 | (c >> 18);
+		dst[1] = 0x80 | ((c >> 12) & 0x3F);
+		dst[2] = 0x80 | ((c >> 6) & 0x3F);
+		dst[3] = 0x80 | (c & 0x3F);
+		return 4;
+	}
+	dst[0] = c - U8_RAW;
+	return 1;
+}
+
+#ifdef __SSE2__
+/* Folds 16 bytes of x into dst if all of them are ASCII, returns non-zero if
+ * it did. CaseFolding.txt has no ASCII mappings but A-Z. */
+static inline int
+u8_fold_ascii16(__m128i x, unsigned char *dst)
+{
+	__m128i t, up;
+	if (_mm_movemask_epi8(x))
+		return 0;
+	t = _mm_sub_epi8(x, _mm_set1_epi8('A'));
+	up = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
+	_mm_storeu_si128((__m128i*)dst, _mm_add_epi8(x, _mm_and_si128(up, _mm_set1_epi8(0x20))));
+	return 1;
+}
+#endif
+
+#endif /* __UCUTF8_H */
@@ -0,0 +1,105 @@
+/*
+ * LD_PRELOAD shim for glibc wide character case functions.
+ *
+ * Build with "make -C test libucwchar.so" and run unmodified binaries as
+ * LD_PRELOAD=test/libucwchar.so program. Results do not depend on locale:
+ * comparisons use simple case folding from /tmp/x, towlower() and towupper()
+ * use simple case mappings from "cf -m" through its two-level BMP tables and
+ * are only replaced when the shim is built with HAVE_CASEMAP (UnicodeData.txt
+ * is present), otherwise glibc versions stay in use.
+ */
+#define _GNU_SOURCE
+#include <wchar.h>
+#include <wctype.h>
+#include <locale.h>
+
+#ifdef HAVE_CASEMAP
+#include "/tmp/ucase_map.h"
+#endif
+
+#define VISIBLE	__attribute__((visibility("default")))
+
+static inline unsigned
+ucwchar_fold(unsigned c)
+{
+#	include "/tmp/x"
+	return c;
+}
+
+#ifdef HAVE_CASEMAP
+/* BMP, ASCII included, is two loads with no branch on the kind of text (ASCII
+ * check mispredicts on mixed input). WEOF and other values outside of Unicode
+ * are returned as is. */
+VISIBLE wint_t
+towlower(wint_t c)
+{
+	if (c > 0xFFFF)
+		return c > 0x10FFFF ? c : ucase_tolower(c);
+	return ucase_tolower_flat(c);
+}
+
+VISIBLE wint_t
+towupper(wint_t c)
+{
+	if (c > 0xFFFF)
+		return c > 0x10FFFF ? c : ucase_toupper(c);
+	return ucase_toupper_flat(c);
+}
+
+VISIBLE wint_t
+towlower_l(wint_t c, locale_t l)
+{
+	return towlower(c);
+}
+
+VISIBLE wint_t
+towupper_l(wint_t c, locale_t l)
+{
+	return towupper(c);
+}
+#endif
+
+static inline unsigned
+fold(wchar_t c)
+{
+	unsigned u = c;
+	if (u < 0x80)
+		return u - 'A' < 26 ? u + 0x20 : u;
+	return u > 0x10FFFF ? u : ucwchar_fold(u);
+}
+
+VISIBLE int
+wcsncasecmp(const wchar_t *a, const wchar_t *b, size_t n)
+{
+	for (; n; n--, a++, b++) {
+		unsigned fa, fb;
+		if (*a == *b) {
+			if (!*a)
+				return 0;
+			continue;
+		}
+		fa = fold(*a);
+		fb = fold(*b);
+		if (fa != fb)
+			return fa < fb ? -1 : 1;
+	}
+	return 0;
+}
+
+VISIBLE int
+wcscasecmp(const wchar_t *a, const wchar_t *b)
+{
+	return wcsncasecmp(a, b, (size_t)-1);
+}
+
+VISIBLE int
+wcscasecmp_l(const wchar_t *a, const wchar_t *b, locale_t l)
+{
+	return wcsncasecmp(a, b, (size_t)-1);
+}
+
+VISIBLE int
+wcsncasecmp_l(const wchar_t *a, const wchar_t *b, size_t n, locale_t l)
+{
+	return wcsncasecmp(a, b, n);
+}